@@ -4,38 +4,184 @@ from argparse import ArgumentParser
 import os
 import subprocess
 
+# Build profiles of the simulators: the write_cxxrtl flags of the generated
+# model and the flags of the C++ compiler. The pgo profile uses the profile
+# recorded by pgo_training_commands(). Every profile keeps the debug
+# information of all public wires (-g4), which the waveforms, the recorder and
+# debug_items need and which does not slow down eval().
+profiles = {
+    "debug":
+        ( ("-O0", "-g4")
+        , ("-O0", "-g")
+        ),
+    "release":
+        ( ("-O6", "-g4")
+        , ("-O3", "-march=native")
+        ),
+    "pgo":
+        ( ("-O6", "-g4")
+        , ( "-O3"
+          , "-march=native"
+          , "-flto"
+          , "-fuse-ld=lld"
+          , "-fprofile-instr-use=output/pgo/benchmark.profdata"
+          # The profile is recorded by the benchmark, so functions that
+          # only exist in the simulator have none.
+          , "-Wno-profile-instr-unprofiled"
+          , "-Wno-profile-instr-out-of-date"
+          )
+        ),
+}
+
+# The firmware that the pgo profile is trained on and that the benchmarks run.
+workload_firmware = "output/workload.bin"
+workload_cycles   = "2000000"
+
+def cxxrtl_command(profile):
+    cxxrtl_flags, _ = profiles[profile]
+    return ( "yosys"
+           , "scripts/simulator.ys"
+           , "-p", " ".join(("write_cxxrtl",) + cxxrtl_flags + ("output/Cpu.hpp",))
+           )
+
+def compile_command(profile, output_path, source_path, *extra_flags):
+    _, compiler_flags = profiles[profile]
+    return ( ( "clang++"
+             , "-std=c++20"
+             , "-I", "code"
+             , "-o", output_path
+             )
+           + compiler_flags
+           + extra_flags
+           + (source_path,)
+           )
+
+# The assembler includes the mnemonic hash table that these generate.
+def schema_table_commands():
+    return ( ("clang", "-o", "output/make_schema_table", "code/assembler/make_schema_table.c")
+           , ("output/make_schema_table", "output/schema_table.h")
+           )
+
+def workload_commands():
+    return schema_table_commands() + (
+        ("clang", "-o", "output/assembler", "code/assembler/main.c")
+        , ("output/assembler", "code/firmware/test.asm", workload_firmware)
+        )
+
+def pgo_training_commands():
+    return workload_commands() + (
+        cxxrtl_command("release")
+        , compile_command
+            ( "release"
+            , "output/pgo/benchmark"
+            , "code/benchmark.cpp"
+            , "-flto"
+            , "-fuse-ld=lld"
+            , "-fprofile-instr-generate=output/pgo/benchmark.profraw"
+            )
+        , ("output/pgo/benchmark", workload_firmware, workload_cycles)
+        , ( "llvm-profdata"
+          , "merge"
+          , "-o", "output/pgo/benchmark.profdata"
+          , "output/pgo/benchmark.profraw"
+          )
+        )
+
 def main():
     parser = ArgumentParser()
     parser.add_argument("--assembler", action="store_true")
-    parser.add_argument("--debug", action="store_true")
+    parser.add_argument("--assembler-benchmark", action="store_true")
     parser.add_argument("--simulator", action="store_true")
+    parser.add_argument("--simulator-benchmark", action="store_true")
+    parser.add_argument("--benchmark-profiles", action="store_true")
+    # Without --profile every build uses the release profile.
+    parser.add_argument("--profile", choices=profiles.keys())
+    parser.add_argument("--library", action="store_true")
+    parser.add_argument("--batch-simulator", action="store_true")
     parser.add_argument("--synthesize", action="store_true")
     parser.add_argument("--program", action="store_true")
     parser.add_argument("--gamma-table", action="store_true")
 
     arguments = parser.parse_args()
 
-    try:
-        os.mkdir("output")
-    except FileExistsError:
-        pass
+    os.makedirs("output/pgo", exist_ok=True)
 
     commands = []
 
+    if (arguments.simulator or arguments.simulator_benchmark or arguments.library or arguments.batch_simulator) and arguments.profile == "pgo":
+        commands.extend(pgo_training_commands())
+
     if arguments.simulator:
+        profile = arguments.profile or "release"
+        commands.extend(
+            ( cxxrtl_command(profile)
+            , compile_command(profile, "output/simulator", "code/simulator.cpp", "-pthread")
+            )
+        )
+
+    if arguments.simulator_benchmark:
+        profile = arguments.profile or "release"
+        commands.extend(
+            ( cxxrtl_command(profile)
+            , compile_command(profile, "output/benchmark", "code/benchmark.cpp")
+            )
+        )
+
+    # Builds the benchmark with every profile and runs each build on the
+    # same workload.
+    if arguments.benchmark_profiles:
+        commands.extend(pgo_training_commands())
+        for profile in profiles:
+            benchmark_path = "output/benchmark-" + profile
+            commands.extend(
+                ( cxxrtl_command(profile)
+                , compile_command(profile, benchmark_path, "code/benchmark.cpp")
+                , (benchmark_path, workload_firmware, workload_cycles)
+                )
+            )
+
+    # The C API of the library is declared in code/ulx3s_sim.h.
+    if arguments.library:
+        profile = arguments.profile or "release"
         commands.extend(
-            ( ("yosys", "scripts/simulator.ys")
-            , ( "clang++"
-                , "-std=c++20"
-                , "-I", "code"
-                , "-o", "output/simulator"
-                , "-g"
-                , "code/simulator.cpp"
+            ( cxxrtl_command(profile)
+            , compile_command
+                ( profile
+                , "output/libulx3s_sim.so"
+                , "code/ulx3s_sim.cpp"
+                , "-shared"
+                , "-fPIC"
+                , "-fvisibility=hidden"
+                , "code/cxxrtl/capi/cxxrtl_capi.cc"
                 )
             )
         )
 
+    # The batched model is a hand-written copy of Cpu.sv, so it is checked
+    # against the generated one on every build.
+    if arguments.batch_simulator:
+        profile = arguments.profile or "release"
+        commands.extend(
+            ( cxxrtl_command(profile)
+            , compile_command(profile, "output/batch_simulator", "code/batch_simulator.cpp")
+            )
+        )
+        commands.extend(schema_table_commands())
+        commands.extend(
+            ( ("clang", "-o", "output/assembler", "code/assembler/main.c")
+            , ("output/assembler", "code/firmware/test.asm", "output/test.bin")
+            , ("output/assembler", "code/firmware/blink.asm", "output/blink.bin")
+            , ( "output/batch_simulator"
+              , "--check"
+              , "--instances", "64"
+              , "output/test.bin"
+              , "output/blink.bin"
+              )
+            )
+        )
+
     if arguments.assembler:
+        commands.extend(schema_table_commands())
         commands.append(
             ( "clang"
             , "-Wall"
@@ -45,6 +191,19 @@ def main():
             )
         )
 
+    if arguments.assembler_benchmark:
+        commands.extend(schema_table_commands())
+        commands.extend(
+            ( ( "clang"
+                , "-Wall"
+                , "-O2"
+                , "-o", "output/assembler_benchmark"
+                , "code/assembler/benchmark.c"
+                )
+            , ("output/assembler_benchmark",)
+            )
+        )
+
     if arguments.synthesize or arguments.program:
         commands.extend(
             ( ("yosys", "scripts/synthesize.ys")
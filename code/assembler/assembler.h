@@ -1,161 +1,426 @@
-typedef enum {
-    OPCODE_IMM    = 0b0010011,
-    OPCODE_LUI    = 0b0110111,
-    OPCODE_AUIPC  = 0b0010111,
-    OPCODE_OP     = 0b0110011,
-    OPCODE_JAL    = 0b1101111,
-    OPCODE_JALR   = 0b1100111,
-    OPCODE_BRANCH = 0b1100011,
-    OPCODE_LOAD   = 0b0000011,
-    OPCODE_STORE  = 0b0100011,
-} Opcode;
-
-#define FUNCT3_ADD  0b000
-#define FUNCT3_SUB  ((1 << 18) | 0b000)
-#define FUNCT3_SLL  0b001
-#define FUNCT3_SLT  0b010
-#define FUNCT3_SLTU 0b011
-#define FUNCT3_XOR  0b100
-#define FUNCT3_SRL  0b101
-#define FUNCT3_SRA  ((1 << 18) | 0b101)
-#define FUNCT3_OR   0b110
-#define FUNCT3_AND  0b111
-
-#define FUNCT3_BEQ  0b000
-#define FUNCT3_BNE  0b001
-#define FUNCT3_BLT  0b100
-#define FUNCT3_BGE  0b101
-#define FUNCT3_BLTU 0b110
-#define FUNCT3_BGEU 0b111
-
-#define FUNCT3_B   0b000
-#define FUNCT3_H   0b001
-#define FUNCT3_W   0b010
-#define FUNCT3_LBU 0b100
-#define FUNCT3_LHU 0b101
-
-typedef struct {
-    Bytes  operation;
-    Opcode opcode;
-    I64    funct3;
-} Schema;
-
-static const Schema schemas[] = {
-    { make_bytes("addi")  , OPCODE_IMM   , FUNCT3_ADD  },
-    { make_bytes("slti")  , OPCODE_IMM   , FUNCT3_SLT  },
-    { make_bytes("sltiu") , OPCODE_IMM   , FUNCT3_SLTU },
-    { make_bytes("andi")  , OPCODE_IMM   , FUNCT3_AND  },
-    { make_bytes("ori")   , OPCODE_IMM   , FUNCT3_OR   },
-    { make_bytes("xori")  , OPCODE_IMM   , FUNCT3_XOR  },
-    { make_bytes("slli")  , OPCODE_IMM   , FUNCT3_SLL  },
-    { make_bytes("srli")  , OPCODE_IMM   , FUNCT3_SRL  },
-    { make_bytes("srai")  , OPCODE_IMM   , FUNCT3_SRA  },
-    { make_bytes("lui")   , OPCODE_LUI   , 0           },
-    { make_bytes("auipc") , OPCODE_AUIPC , 0           },
-    { make_bytes("add")   , OPCODE_OP    , FUNCT3_ADD  },
-    { make_bytes("sub")   , OPCODE_OP    , FUNCT3_SUB  },
-    { make_bytes("slt")   , OPCODE_OP    , FUNCT3_SLT  },
-    { make_bytes("sltu")  , OPCODE_OP    , FUNCT3_SLTU },
-    { make_bytes("and")   , OPCODE_OP    , FUNCT3_AND  },
-    { make_bytes("or")    , OPCODE_OP    , FUNCT3_OR   },
-    { make_bytes("xor")   , OPCODE_OP    , FUNCT3_XOR  },
-    { make_bytes("sll")   , OPCODE_OP    , FUNCT3_SLL  },
-    { make_bytes("srl")   , OPCODE_OP    , FUNCT3_SRL  },
-    { make_bytes("sra")   , OPCODE_OP    , FUNCT3_SRA  },
-    { make_bytes("jal")   , OPCODE_JAL   , 0           },
-    { make_bytes("jalr")  , OPCODE_JALR  , 0           },
-    { make_bytes("beq")   , OPCODE_BRANCH, FUNCT3_BEQ  },
-    { make_bytes("bne")   , OPCODE_BRANCH, FUNCT3_BNE  },
-    { make_bytes("blt")   , OPCODE_BRANCH, FUNCT3_BLT  },
-    { make_bytes("bltu")  , OPCODE_BRANCH, FUNCT3_BLTU },
-    { make_bytes("bge")   , OPCODE_BRANCH, FUNCT3_BGE  },
-    { make_bytes("bgeu")  , OPCODE_BRANCH, FUNCT3_BGEU },
-    { make_bytes("lb")    , OPCODE_LOAD  , FUNCT3_B    },
-    { make_bytes("lh")    , OPCODE_LOAD  , FUNCT3_H    },
-    { make_bytes("lw")    , OPCODE_LOAD  , FUNCT3_W    },
-    { make_bytes("lbu")   , OPCODE_LOAD  , FUNCT3_LBU  },
-    { make_bytes("lhu")   , OPCODE_LOAD  , FUNCT3_LHU  },
-    { make_bytes("sb")    , OPCODE_STORE , FUNCT3_B    },
-    { make_bytes("sh")    , OPCODE_STORE , FUNCT3_H    },
-    { make_bytes("sw")    , OPCODE_STORE , FUNCT3_W    },
-};
-
 static const Schema* find_schema(Bytes operation) {
-    for (I64 i = 0; i < length(schemas); i++) {
-        const Schema* schema = &schemas[i];
-        if (bytes_equal(operation, schema->operation)) {
-            return schema;
-        }
+    I64 index = schema_slots[schema_slot(schema_multiplier, operation)];
+    if (index == 0) {
+        return NULL;
     }
-    return NULL;
+    const Schema* schema = &schemas[index - 1];
+    return bytes_equal(operation, schema->operation) ? schema : NULL;
 }
 
+typedef enum {
+    SECTION_TEXT,
+    SECTION_DATA,
+    SECTION_COUNT,
+} Section;
+
+// While assembling, `offset` is from the start of `section`, and
+// `fixup_index` is the number of fixups before the label, which relaxation
+// needs. Once the sections are laid out, `offset` is the address.
 typedef struct {
-    Bytes name;
-    I64   offset;
+    Bytes   name;
+    I64     offset;
+    Section section;
+    I64     fixup_index;
 } Label;
 
+// Open addressing hash table of labels with linear probing. A slot is empty if
+// its name has no data. The table is kept at most half full, and grows by
+// moving into a new array twice the size, taken from the arena.
 typedef struct {
-    Label* data;
-    I64    size;
+    Label* slots;
+    I64    capacity;
+    I64    count;
 } Labels;
 
+#define LABELS_MINIMUM_CAPACITY 64
+
+// Reserved address space for the arena of an assembly; pages are only backed
+// once they are used.
+#define ASSEMBLER_ARENA_SIZE (1l << 30 /* 1 GiB */)
+
+static U64 hash_label(Bytes name) {
+    U64 hash = 14695981039346656037u;
+    for (I64 i = 0; i < name.size; i++) {
+        hash = (hash ^ name.data[i]) * 1099511628211u;
+    }
+    return hash;
+}
+
+// Returns the slot of `name`, or the empty slot where it belongs.
+static Label* find_label_slot(Label* slots, I64 capacity, Bytes name) {
+    I64 mask = capacity - 1;
+    for (I64 i = hash_label(name) & mask;; i = (i + 1) & mask) {
+        Label* slot = &slots[i];
+        if (slot->name.data == NULL || bytes_equal(slot->name, name)) {
+            return slot;
+        }
+    }
+}
+
 static Label* find_label(Labels* labels, Bytes name) {
-    for (I64 i = 0; i < labels->size; i++) {
-        Label* label = &labels->data[i];
-        if (bytes_equal(label->name, name)) {
-            return label;
+    if (labels->capacity == 0) {
+        return NULL;
+    }
+    Label* slot = find_label_slot(labels->slots, labels->capacity, name);
+    return slot->name.data != NULL ? slot : NULL;
+}
+
+static void grow_labels(Labels* labels, Lexer* lexer, Arena* arena) {
+    I64    capacity = max(2 * labels->capacity, LABELS_MINIMUM_CAPACITY);
+    Label* slots    = (Label*) lexer_push_bytes(lexer, arena, capacity * sizeof(Label));
+    memset(slots, 0, capacity * sizeof(Label));
+
+    for (I64 i = 0; i < labels->capacity; i++) {
+        Label* label = &labels->slots[i];
+        if (label->name.data != NULL) {
+            *find_label_slot(slots, capacity, label->name) = *label;
         }
     }
-    return NULL;
+
+    labels->slots    = slots;
+    labels->capacity = capacity;
+}
+
+// Returns false if a label with the same name already exists.
+static bool add_label(Labels* labels, Lexer* lexer, Arena* arena, Label label) {
+    if (2 * (labels->count + 1) > labels->capacity) {
+        grow_labels(labels, lexer, arena);
+    }
+
+    Label* slot = find_label_slot(labels->slots, labels->capacity, label.name);
+    if (slot->name.data != NULL) {
+        return false;
+    }
+    *slot = label;
+    labels->count++;
+    return true;
 }
 
+// A reference to a label from the control transfer instruction at `pc` in
+// .text, or the padding from `pc` to `target` that .align or .org left there.
+// A numeric offset of a control transfer is a reference too, to the fixed
+// `target` that it gives before relaxation, so it moves with the code like a
+// label. `name` points into the text, which gives the position of the
+// reference for error messages.
+//
+// References are resolved once every label is known and the branches have been
+// relaxed: a branch whose target is out of its range is rewritten as the
+// inverted branch over a jal to the target, and the padding after it changes
+// size to keep its end aligned. `pc` and `target` are offsets before
+// relaxation, `address` is the offset after, and `growth` is how many bytes
+// relaxation added to the instruction or padding.
 typedef struct {
-    Labels labels;
-    Lexer  lexer;
+    Bytes  name;
     I64    pc;
+    Opcode opcode;
+    I64    target;
+    I64    target_index; // fixup_index of the target label
+    I64    alignment;    // of the end of padding, or 0 for the fixed end of .org
+    I64    address;
+    I64    growth;
+    bool   padding;
+    bool   numeric;      // whether `target` is given by a numeric offset
+    bool   relaxed;
+} Fixup;
+
+typedef enum {
+    REFERENCE_WORD,  // .word
+    REFERENCE_HIGH,  // %hi() in lui
+    REFERENCE_LOW_I, // %lo() in an instruction with an I-type immediate
+    REFERENCE_LOW_S, // %lo() in a store
+} ReferenceType;
+
+// A use of the address of a label, which is only known once the sections are
+// laid out.
+typedef struct {
+    Bytes         name;
+    I64           offset;
+    Section       section;
+    I64           fixup_index;
+    ReferenceType type;
+} Reference;
+
+// Instructions in .text from `start` to `end` that may be reordered: no label
+// or numeric branch target is between them, and none of them depends on its
+// address. There are no fixups between them either, so `fixup_index` relocates
+// all of them. If `terminated`, the block is followed by the control transfer
+// that ended it, at `end`. Once the sections are laid out, `start` and `end`
+// are addresses.
+typedef struct {
+    I64  start;
+    I64  end;
+    I64  fixup_index;
+    bool terminated;
+} Block;
+
+// .data follows .text in memory, from the first address after it that is
+// aligned for the largest .align of .data.
+typedef struct {
+    Labels  labels;
+    Lexer   lexer;
+    Arena   arena;                    // label table
+    Arena   sections[SECTION_COUNT];  // bytes of each section
+    I64     alignments[SECTION_COUNT];
+    Section section;                  // the one being assembled into
+    Arena   fixups;                   // Fixup, sorted by pc
+    Arena   references;               // Reference
+    bool    relaxed;                  // whether any branch was relaxed
+    I64     data_address;
+    bool    find_blocks;
+    Arena   blocks;                   // Block, sorted by start
+    I64     block_start;
+    I64     block_fixup_index;
 } Assembler;
 
-static I64 parse_label(Assembler* assembler) {
-    Labels* labels = &assembler->labels;
-    I64     output = 0;
+#define JAL_OFFSET_MINIMUM    (-0x100000)
+#define JAL_OFFSET_MAXIMUM    0xFFFFE
+#define BRANCH_OFFSET_MINIMUM (-0x1000)
+#define BRANCH_OFFSET_MAXIMUM 0xFFE
 
-    if (labels != NULL) {
-        Lexer* lexer  = &assembler->lexer;
-        Bytes  lexeme = lexer->lexeme_bytes;
-        Label* label  = find_label(labels, lexeme);
-        if (label == NULL) {
-            lexer_error(lexer, "Label \"%s\" is not defined.\n", lexeme);
+// Flips the lowest bit of funct3, which turns beq into bne, blt into bge and
+// bltu into bgeu, and the other way around.
+#define BRANCH_INVERT (1 << 12)
+
+static void check_offset(Lexer* lexer, I64 offset, I64 minimum, I64 maximum) {
+    if (offset < minimum) {
+        lexer_error(lexer, "Offset is too small. Minimum value must be -0x%x.\n", -minimum);
+    }
+    if (offset > maximum) {
+        lexer_error(lexer, "Offset too large. Maximum value must be 0x%x.\n", maximum);
+    }
+}
+
+// Returns the immediate bits of a control transfer instruction with `opcode`
+// for the offset from it to its target.
+static I64 encode_offset(Lexer* lexer, Opcode opcode, I64 offset) {
+    I64 immediate = 0;
+    switch (opcode) {
+
+    case OPCODE_JAL:
+        check_offset(lexer, offset, JAL_OFFSET_MINIMUM, JAL_OFFSET_MAXIMUM);
+        if (offset % 2 != 0) {
+            lexer_error(lexer, "jal offset must be a multiple of 2.\n");
         }
-        output = assembler->pc - label->offset;
+        immediate |= slice_bits(offset, 12, 19) << 12;
+        immediate |= test_bit(offset, 11)       << 20;
+        immediate |= slice_bits(offset, 1, 10)  << 21;
+        immediate |= test_bit(offset, 20)       << 31;
+        break;
+
+    case OPCODE_BRANCH:
+        check_offset(lexer, offset, BRANCH_OFFSET_MINIMUM, BRANCH_OFFSET_MAXIMUM);
+        if (offset % 2 != 0) {
+            lexer_error(lexer, "Branch offset must be a multiple of 2.\n");
+        }
+        immediate |= test_bit(offset, 11)      << 7;
+        immediate |= slice_bits(offset, 1, 4)  << 8;
+        immediate |= slice_bits(offset, 5, 10) << 25;
+        immediate |= test_bit(offset, 12)      << 31;
+        break;
+
+    default:
+        assert(false);
+
     }
+    return immediate;
+}
 
-    return output;
+// Returns the bits of an I-type or S-type immediate.
+static I64 encode_immediate(I64 value, bool store) {
+    if (store) {
+        return slice_bits(value, 0, 4) << 7 | slice_bits(value, 5, 11) << 25;
+    }
+    return slice_bits(value, 0, 11) << 20;
 }
 
-static I64 parse_offset(Assembler* assembler, I64 minimum, I64 maximum) {
-    Lexer*            lexer  = &assembler->lexer;
-    I64               output = 0;
-    ParseNumberResult result = try_parse_number(lexer, minimum, maximum, &output);
-    if (result != PARSE_NUMBER_OK) {
-        output = parse_label(assembler);
-        if (output < minimum) {
-            lexer_error(lexer, "Offset is too small. Minimum value must be 0x%x.\n", minimum);
-        }
-        if (output > maximum) {
-            lexer_error(lexer, "Offset too large. Maximum value must be 0x%x.\n", maximum);
+// %hi() and %lo() split a value for lui and a 12-bit immediate. The immediate
+// is sign extended, so the upper part is rounded up when it is negative.
+static I64 high_part(I64 value) {
+    return (value + 0x800) & 0xFFFFF000;
+}
+
+static I64 low_part(I64 value) {
+    return ((value & 0xFFF) ^ 0x800) - 0x800;
+}
+
+// Remembers that the address of the label in the current lexeme goes into the
+// current section at `offset`.
+static void add_reference(Assembler* assembler, ReferenceType type, I64 offset) {
+    Lexer*     lexer     = &assembler->lexer;
+    Reference* reference = (Reference*) lexer_push_bytes(lexer, &assembler->references, sizeof(Reference));
+    *reference           = (Reference) {
+        .name        = lexer->lexeme_bytes,
+        .offset      = offset,
+        .section     = assembler->section,
+        .fixup_index = assembler->fixups.used / (I64) sizeof(Fixup),
+        .type        = type,
+    };
+}
+
+// Parses `%hi(VALUE)` for REFERENCE_HIGH or `%lo(VALUE)` otherwise into
+// `output`, and returns false if the lexeme is neither. A VALUE that is a label
+// gets a reference, and an output of 0 until resolve_references().
+static bool parse_part(Assembler* assembler, ReferenceType type, I64* output) {
+    Lexer* lexer  = &assembler->lexer;
+    Bytes  lexeme = lexer->lexeme_bytes;
+    char*  prefix = "%lo(";
+    if (type == REFERENCE_HIGH) {
+        prefix = "%hi(";
+    }
+    if (!starts_with(lexeme, prefix) || !ends_with(lexeme, ")")) {
+        return false;
+    }
+
+    lexer->lexeme_bytes = drop(take(lexeme, -1), 4);
+    if (try_parse_number(lexer, INT32_MIN, UINT32_MAX, output) == PARSE_NUMBER_NOT_INTEGER) {
+        add_reference(assembler, type, assembler->sections[SECTION_TEXT].used);
+        *output = 0;
+        return true;
+    }
+
+    I64 value = parse_number(lexer, INT32_MIN, UINT32_MAX);
+    *output   = type == REFERENCE_HIGH ? high_part(value) : low_part(value);
+    return true;
+}
+
+// Parses a 12-bit immediate: a number from -0x800 to 0xFFF, of which only
+// the lowest 12 bits are kept, or %lo().
+static I64 parse_immediate(Assembler* assembler, ReferenceType type) {
+    I64 value = 0;
+    if (!parse_part(assembler, type, &value)) {
+        value = parse_number(&assembler->lexer, -0x800, 0xFFF);
+    }
+    return value;
+}
+
+// Parses a numeric offset or a label and returns its immediate bits, which
+// are 0 until resolve_fixups(). Both get a fixup, so that a numeric offset
+// still reaches the instruction it was written for once relaxation has moved
+// the code between them.
+static I64 parse_offset(Assembler* assembler, Opcode opcode) {
+    Lexer* lexer   = &assembler->lexer;
+    I64    pc      = assembler->sections[SECTION_TEXT].used;
+    I64    offset  = 0;
+    bool   numeric = try_parse_number(lexer, INT32_MIN, INT32_MAX, &offset) != PARSE_NUMBER_NOT_INTEGER;
+    if (numeric) {
+        offset = parse_number(lexer, INT32_MIN, INT32_MAX);
+    }
+
+    Fixup* fixup = (Fixup*) lexer_push_bytes(lexer, &assembler->fixups, sizeof(Fixup));
+    *fixup       = (Fixup) {
+        .name    = lexer->lexeme_bytes,
+        .pc      = pc,
+        .opcode  = opcode,
+        .target  = pc + offset,
+        .numeric = numeric,
+    };
+    return 0;
+}
+
+static void emit_instruction(Assembler* assembler, Opcode opcode, I64 funct3, I64 rd, I64 rs1, I64 rs2, I64 immediate) {
+    U32 instruction = 0;
+    instruction    |= opcode;
+    instruction    |= rd     << 7;
+    instruction    |= funct3 << 12;
+    instruction    |= rs1    << 15;
+    instruction    |= rs2    << 20;
+    instruction    |= immediate;
+
+    Lexer* lexer = &assembler->lexer;
+    memcpy(lexer_push_bytes(lexer, &assembler->sections[SECTION_TEXT], sizeof(U32)), &instruction, sizeof(U32));
+}
+
+// Loads `value`, a 32-bit number, with the fewest instructions.
+static void emit_load_immediate(Assembler* assembler, I64 rd, I64 value) {
+    value = (I32) (U32) value;
+    if (-0x800 <= value && value <= 0x7FF) {
+        emit_instruction(assembler, OPCODE_IMM, FUNCT3_ADD, rd, 0, 0, encode_immediate(value, false));
+        return;
+    }
+
+    emit_instruction(assembler, OPCODE_LUI, 0, rd, 0, 0, high_part(value));
+    if (low_part(value) != 0) {
+        emit_instruction(assembler, OPCODE_IMM, FUNCT3_ADD, rd, rd, 0, encode_immediate(low_part(value), false));
+    }
+}
+
+static void next_pseudo_instruction(Assembler* assembler, const Schema* schema) {
+    Lexer* lexer     = &assembler->lexer;
+    Opcode opcode    = schema->opcode;
+    I64    funct3    = schema->funct3;
+    I64    rd        = 0;
+    I64    rs1       = 0;
+    I64    immediate = 0;
+
+    switch (schema->pseudo) {
+
+    case PSEUDO_NOP:
+        break;
+
+    case PSEUDO_MV:
+        rd  = lex_register(lexer);
+        rs1 = lex_register(lexer);
+        break;
+
+    case PSEUDO_LI:
+        rd = lex_register(lexer);
+        lex_operand(lexer);
+        emit_load_immediate(assembler, rd, parse_number(lexer, INT32_MIN, UINT32_MAX));
+        return;
+
+    case PSEUDO_LA: {
+        rd = lex_register(lexer);
+        lex_operand(lexer);
+        I64 value = 0;
+        if (try_parse_number(lexer, INT32_MIN, UINT32_MAX, &value) != PARSE_NUMBER_NOT_INTEGER) {
+            emit_load_immediate(assembler, rd, parse_number(lexer, INT32_MIN, UINT32_MAX));
+            return;
         }
+        // The address is only known once the sections are laid out.
+        I64 offset = assembler->sections[SECTION_TEXT].used;
+        add_reference(assembler, REFERENCE_HIGH, offset);
+        add_reference(assembler, REFERENCE_LOW_I, offset + 4);
+        emit_instruction(assembler, OPCODE_LUI, 0, rd, 0, 0, 0);
+        emit_instruction(assembler, OPCODE_IMM, FUNCT3_ADD, rd, rd, 0, 0);
+        return;
     }
-    return output;
+
+    case PSEUDO_J:
+    case PSEUDO_CALL:
+        rd = schema->pseudo == PSEUDO_CALL ? 1 : 0;
+        lex_operand(lexer);
+        immediate = parse_offset(assembler, OPCODE_JAL);
+        break;
+
+    case PSEUDO_RET:
+        rs1 = 1;
+        break;
+
+    case PSEUDO_BZ:
+        rs1 = lex_register(lexer);
+        lex_operand(lexer);
+        immediate = parse_offset(assembler, OPCODE_BRANCH);
+        break;
+
+    default:
+        assert(false);
+
+    }
+
+    emit_instruction(assembler, opcode, funct3, rd, rs1, 0, immediate);
 }
 
-static I64 next_instruction(Assembler* assembler) {
+static void next_instruction(Assembler* assembler) {
     Lexer* lexer = &assembler->lexer;
 
     const Schema* schema = find_schema(lexer->lexeme_bytes);
     if (schema == NULL) {
         lexer_error(lexer, "Invalid operation \"%s\".\n", lexer->lexeme_bytes);
     }
+    if (schema->pseudo != PSEUDO_NONE) {
+        next_pseudo_instruction(assembler, schema);
+        return;
+    }
 
     Opcode opcode    = schema->opcode;
     I64    funct3    = schema->funct3;
@@ -196,12 +461,20 @@ static I64 next_instruction(Assembler* assembler) {
     case OPCODE_IMM:
     case OPCODE_JALR:
     case OPCODE_LOAD:
-        parsed    = parse_number(lexer, 0, 0x7FF);
-        immediate = parsed << 20;
+        // Shift amounts are 5 bits, and the bits above them select srai.
+        if (opcode == OPCODE_IMM && (funct3 & 0b11) == 0b01) {
+            parsed = parse_number(lexer, 0, 31);
+        } else {
+            parsed = parse_immediate(assembler, REFERENCE_LOW_I);
+        }
+        immediate = encode_immediate(parsed, false);
         break;
 
     case OPCODE_LUI:
     case OPCODE_AUIPC:
+        if (opcode == OPCODE_LUI && parse_part(assembler, REFERENCE_HIGH, &immediate)) {
+            break;
+        }
         immediate = parse_number(lexer, 0, 0xFFFFF000);
         if (immediate & 0xFFF) {
             lexer_error(lexer, "Offset must be a multiple of 0x1000.\n");
@@ -213,35 +486,20 @@ static I64 next_instruction(Assembler* assembler) {
         break;
 
     case OPCODE_JAL:
-        parsed = parse_offset(assembler, 0, 0xFFFFF);
-        if (parsed % 2 != 0) {
-            lexer_error(lexer, "jal offset must be a multiple of 2.\n");
-        }
-        immediate |= slice_bits(parsed, 12, 19) << 12;
-        immediate |= test_bit(parsed, 11)       << 20;
-        immediate |= slice_bits(parsed, 1, 10)  << 21;
-        immediate |= test_bit(parsed, 20)       << 31;
+        immediate = parse_offset(assembler, OPCODE_JAL);
         break;
 
     case OPCODE_BRANCH:
-        rs2   = parse_register(lexer);
+        rs2       = parse_register(lexer);
         lex_operand(lexer);
-        parsed = parse_number(lexer, 0, 0xFFF);
-        if (parsed & 1) {
-            lexer_error(lexer, "Branch offset must be a multiple of 2.\n");
-        }
-        immediate |= test_bit(parsed, 11)      << 7;
-        immediate |= slice_bits(parsed, 1, 4)  << 8;
-        immediate |= slice_bits(parsed, 5, 10) << 25;
-        immediate |= test_bit(parsed, 12)      << 31;
+        immediate = parse_offset(assembler, OPCODE_BRANCH);
         break;
 
     case OPCODE_STORE:
         rs2        = parse_register(lexer);
         lex_operand(lexer);
-        parsed     = parse_number(lexer, 0, 0xFFF);
-        immediate |= slice_bits(parsed, 0, 4) << 7;
-        immediate |= slice_bits(parsed, 5, 11) << 25;
+        parsed     = parse_immediate(assembler, REFERENCE_LOW_S);
+        immediate  = encode_immediate(parsed, true);
         break;
 
     default:
@@ -249,36 +507,714 @@ static I64 next_instruction(Assembler* assembler) {
 
     }
 
-    I64 instruction = 0;
-    instruction    |= opcode;
-    instruction    |= rd     << 7;
-    instruction    |= funct3 << 12;
-    instruction    |= rs1    << 15;
-    instruction    |= rs2    << 20;
-    instruction    |= immediate;
+    emit_instruction(assembler, opcode, funct3, rd, rs1, rs2, immediate);
+}
+
+// Returns where the byte at `offset` of .text before relaxation ends up after
+// it, given the number of fixups before the byte, `index`. Everything between
+// two fixups moves as much as the second one. The index tells apart the
+// labels defined before and after padding with the same offset.
+static I64 relocate(Assembler* assembler, I64 offset, I64 index) {
+    if (!assembler->relaxed) {
+        return offset;
+    }
+
+    Fixup* fixups      = (Fixup*) assembler->fixups.memory;
+    I64    fixup_count = assembler->fixups.used / sizeof(Fixup);
+    if (index < fixup_count) {
+        return offset + fixups[index].address - fixups[index].pc;
+    }
+    Fixup* last = &fixups[fixup_count - 1];
+    return offset + last->address - last->pc + last->growth;
+}
+
+// Relaxes the branches until no more of them are out of range. A relaxed
+// branch grows, but padding before `.align` or `.org` may shrink and bring
+// targets closer again, so a branch can be relaxed when it no longer needs it.
+// This still ends, usually after one or two rounds, because a branch is never
+// unrelaxed and each round that changes anything relaxes at least one more.
+static void relax_branches(Assembler* assembler) {
+    Lexer* lexer       = &assembler->lexer;
+    Fixup* fixups      = (Fixup*) assembler->fixups.memory;
+    I64    fixup_count = assembler->fixups.used / sizeof(Fixup);
+
+    bool changed = true;
+    while (changed) {
+        changed   = false;
+        I64 shift = 0;
+        for (I64 i = 0; i < fixup_count; i++) {
+            Fixup* fixup   = &fixups[i];
+            fixup->address = fixup->pc + shift;
+            if (fixup->padding) {
+                I64 end = fixup->alignment != 0 ? align_up(fixup->address, fixup->alignment) : fixup->target;
+                if (end < fixup->address) {
+                    lexer->lexeme_bytes = fixup->name;
+                    lexer_error(lexer, "Relaxed branches moved the code past offset 0x%x.\n", fixup->target);
+                }
+                fixup->growth = (end - fixup->address) - (fixup->target - fixup->pc);
+            }
+            shift += fixup->growth;
+        }
+
+        for (I64 i = 0; i < fixup_count; i++) {
+            Fixup* fixup = &fixups[i];
+            if (fixup->opcode != OPCODE_BRANCH || fixup->relaxed) {
+                continue;
+            }
+            I64 offset = relocate(assembler, fixup->target, fixup->target_index) - fixup->address;
+            if (offset < BRANCH_OFFSET_MINIMUM || offset > BRANCH_OFFSET_MAXIMUM) {
+                fixup->relaxed      = true;
+                fixup->growth       = 4;
+                assembler->relaxed  = true;
+                changed             = true;
+            }
+        }
+    }
+}
+
+// Moves .text to its offsets after relaxation, which leaves room for the jals
+// of the relaxed branches and resizes the padding. The moved code is built
+// after the old one in the arena and then copied over it.
+static void move_text(Assembler* assembler) {
+    if (!assembler->relaxed) {
+        return;
+    }
+
+    Arena* text        = &assembler->sections[SECTION_TEXT];
+    Fixup* fixups      = (Fixup*) assembler->fixups.memory;
+    I64    fixup_count = assembler->fixups.used / sizeof(Fixup);
+    I64    size        = text->used;
+    I64    moved_size  = relocate(assembler, size, fixup_count);
+    U8*    moved       = lexer_push_bytes(&assembler->lexer, text, moved_size);
+    U8*    code        = text->memory;
+
+    I64 from = 0;
+    for (I64 i = 0; i < fixup_count; i++) {
+        Fixup* fixup = &fixups[i];
+        I64    end   = fixup->padding ? fixup->pc : fixup->pc + 4;
+        memcpy(&moved[from + fixup->address - fixup->pc], &code[from], end - from);
+        if (fixup->padding) {
+            memset(&moved[fixup->address], 0, fixup->target - fixup->pc + fixup->growth);
+            from = fixup->target;
+        } else {
+            from = end;
+        }
+    }
+    memcpy(&moved[from + moved_size - size], &code[from], size - from);
+
+    memmove(code, moved, moved_size);
+    text->used = moved_size;
+}
+
+// Returns the number of fixups before the byte at `offset` of .text before
+// relaxation, as a label defined there would have recorded it.
+static I64 count_fixups_before(Assembler* assembler, I64 offset) {
+    Fixup* fixups = (Fixup*) assembler->fixups.memory;
+    I64    low    = 0;
+    I64    high   = assembler->fixups.used / sizeof(Fixup);
+    while (low < high) {
+        I64 middle = (low + high) / 2;
+        if (fixups[middle].pc < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Relaxes the branches and patches the target offsets into the instructions.
+static void resolve_fixups(Assembler* assembler) {
+    Lexer* lexer       = &assembler->lexer;
+    Fixup* fixups      = (Fixup*) assembler->fixups.memory;
+    I64    fixup_count = assembler->fixups.used / sizeof(Fixup);
+
+    for (I64 i = 0; i < fixup_count; i++) {
+        Fixup* fixup        = &fixups[i];
+        lexer->lexeme_bytes = fixup->name;
+        if (fixup->padding) {
+            continue;
+        }
+        if (fixup->numeric) {
+            fixup->target_index = count_fixups_before(assembler, fixup->target);
+            continue;
+        }
+
+        Label* label = find_label(&assembler->labels, fixup->name);
+        if (label == NULL) {
+            lexer_error(lexer, "Label \"%s\" is not defined.\n", fixup->name);
+        }
+        if (label->section != SECTION_TEXT) {
+            lexer_error(lexer, "Label \"%s\" is not in .text.\n", fixup->name);
+        }
+        fixup->target       = label->offset;
+        fixup->target_index = label->fixup_index;
+    }
+
+    relax_branches(assembler);
+    move_text(assembler);
+
+    U32* code = (U32*) assembler->sections[SECTION_TEXT].memory;
+    for (I64 i = 0; i < fixup_count; i++) {
+        Fixup* fixup = &fixups[i];
+        if (fixup->padding) {
+            continue;
+        }
+
+        U32* instruction    = &code[fixup->address / 4];
+        I64  target         = relocate(assembler, fixup->target, fixup->target_index);
+        lexer->lexeme_bytes = fixup->name;
+
+        if (fixup->relaxed) {
+            instruction[0] ^= BRANCH_INVERT;
+            instruction[0] |= encode_offset(lexer, OPCODE_BRANCH, 8);
+            instruction[1]  = OPCODE_JAL | encode_offset(lexer, OPCODE_JAL, target - (fixup->address + 4));
+        } else {
+            instruction[0] |= encode_offset(lexer, fixup->opcode, target - fixup->address);
+        }
+    }
+}
+
+// Places .data after .text and turns the offsets of the labels into addresses.
+static void place_labels(Assembler* assembler) {
+    I64 text_size           = assembler->sections[SECTION_TEXT].used;
+    assembler->data_address = align_up(text_size, assembler->alignments[SECTION_DATA]);
+
+    Labels* labels = &assembler->labels;
+    for (I64 i = 0; i < labels->capacity; i++) {
+        Label* label = &labels->slots[i];
+        if (label->name.data == NULL) {
+            continue;
+        }
+        if (label->section == SECTION_TEXT) {
+            label->offset = relocate(assembler, label->offset, label->fixup_index);
+        } else {
+            label->offset = assembler->data_address + label->offset;
+        }
+    }
+}
+
+static void resolve_references(Assembler* assembler) {
+    Lexer*     lexer           = &assembler->lexer;
+    Reference* references      = (Reference*) assembler->references.memory;
+    I64        reference_count = assembler->references.used / sizeof(Reference);
+
+    for (I64 i = 0; i < reference_count; i++) {
+        Reference* reference = &references[i];
+        lexer->lexeme_bytes  = reference->name;
+
+        Label* label = find_label(&assembler->labels, reference->name);
+        if (label == NULL) {
+            lexer_error(lexer, "Label \"%s\" is not defined.\n", reference->name);
+        }
+
+        I64 offset = reference->offset;
+        if (reference->section == SECTION_TEXT) {
+            offset = relocate(assembler, offset, reference->fixup_index);
+        }
+
+        U32 address = label->offset;
+        U32 value   = 0;
+        switch (reference->type) {
+        case REFERENCE_WORD:  value = address;                                        break;
+        case REFERENCE_HIGH:  value = high_part(address);                             break;
+        case REFERENCE_LOW_I: value = encode_immediate(low_part(address), false);     break;
+        case REFERENCE_LOW_S: value = encode_immediate(low_part(address), true);      break;
+        default:              assert(false);
+        }
+
+        // The bits of the address are 0 until now, in words and instructions.
+        U8* site = &assembler->sections[reference->section].memory[offset];
+        U32 word = 0;
+        memcpy(&word, site, sizeof(U32));
+        word |= value;
+        memcpy(site, &word, sizeof(U32));
+    }
+}
+
+typedef enum {
+    DIRECTIVE_WORD,
+    DIRECTIVE_HALF,
+    DIRECTIVE_BYTE,
+    DIRECTIVE_ASCII,
+    DIRECTIVE_SPACE,
+    DIRECTIVE_ALIGN,
+    DIRECTIVE_ORG,
+    DIRECTIVE_SECTION,
+} DirectiveType;
+
+typedef struct {
+    Bytes         name;
+    DirectiveType type;
+} Directive;
+
+static const Directive directives[] = {
+    { make_bytes(".word")    , DIRECTIVE_WORD    },
+    { make_bytes(".half")    , DIRECTIVE_HALF    },
+    { make_bytes(".byte")    , DIRECTIVE_BYTE    },
+    { make_bytes(".ascii")   , DIRECTIVE_ASCII   },
+    { make_bytes(".space")   , DIRECTIVE_SPACE   },
+    { make_bytes(".align")   , DIRECTIVE_ALIGN   },
+    { make_bytes(".org")     , DIRECTIVE_ORG     },
+    { make_bytes(".section") , DIRECTIVE_SECTION },
+};
+
+static const char* section_operands[SECTION_COUNT] = { ".text", ".data" };
+
+// Largest power of two that .align accepts.
+#define ALIGN_MAXIMUM_POWER 16
+
+// Lexes the next value of .word, .half or .byte, and returns false without
+// consuming anything if there is none. Values are numbers, and for .word also
+// labels, which are told apart from what follows the values because that is an
+// operation, a directive or a label definition.
+static bool lex_value(Assembler* assembler, bool label) {
+    Lexer* lexer = &assembler->lexer;
+    Lexer  saved = *lexer;
+    if (!lex(lexer)) {
+        *lexer = saved;
+        return false;
+    }
+
+    Bytes lexeme = lexer->lexeme_bytes;
+    I64   number = 0;
+    if (try_parse_number(lexer, INT32_MIN, UINT32_MAX, &number) != PARSE_NUMBER_NOT_INTEGER) {
+        return true;
+    }
+    if (label && !starts_with(lexeme, ".") && !ends_with(lexeme, ":") && find_schema(lexeme) == NULL) {
+        return true;
+    }
+    *lexer = saved;
+    return false;
+}
+
+// Writes the values of .word (4 bytes), .half (2 bytes) or .byte (1 byte).
+// Negative values are written as two's complement.
+static void write_values(Assembler* assembler, I64 size) {
+    Lexer* lexer   = &assembler->lexer;
+    Arena* section = &assembler->sections[assembler->section];
+    I64    minimum = -(1l << (8 * size - 1));
+    I64    maximum = (1l << (8 * size)) - 1;
+
+    I64 count = 0;
+    while (lex_value(assembler, size == 4)) {
+        I64 value  = 0;
+        I64 offset = section->used;
+        if (try_parse_number(lexer, minimum, maximum, &value) == PARSE_NUMBER_NOT_INTEGER) {
+            add_reference(assembler, REFERENCE_WORD, offset);
+        } else {
+            value = parse_number(lexer, minimum, maximum);
+        }
+        memcpy(lexer_push_bytes(lexer, section, size), &value, size);
+        count++;
+    }
 
-    assembler->pc += 4;
-    return instruction;
+    if (count == 0) {
+        lexer_error(lexer, "Missing operand.\n");
+    }
 }
 
-static void compute_label_offsets(Assembler* assembler) {
-    Lexer*  lexer        = &assembler->lexer;
-    Buffer* console      = lexer->console;
-    Arena   labels_arena = make_arena(console, getpagesize());
+// Writes the string in the current lexeme without its quotes, and with its
+// escape sequences (\n, \t, \r, \0, \\ and \") replaced.
+static void write_string(Assembler* assembler) {
+    Lexer* lexer   = &assembler->lexer;
+    Arena* section = &assembler->sections[assembler->section];
+    Bytes  string  = drop(take(lexer->lexeme_bytes, -1), 1);
+    U8*    output  = lexer_push_bytes(lexer, section, string.size);
+
+    I64 size = 0;
+    for (I64 i = 0; i < string.size; i++) {
+        U8 c = string.data[i];
+        if (c == '\\') {
+            i++;
+            switch (string.data[i]) {
+            case 'n':  c = '\n'; break;
+            case 't':  c = '\t'; break;
+            case 'r':  c = '\r'; break;
+            case '0':  c = 0;    break;
+            case '\\': c = '\\'; break;
+            case '"':  c = '"';  break;
+            default:
+                lexer_error(lexer, "Invalid escape sequence \"\\%c\".\n", (I32) string.data[i]);
+            }
+        }
+        output[size++] = c;
+    }
+    section->used -= string.size - size;
+}
+
+// Pads the current section with zeros up to `end`. In .text, the padding is
+// remembered for relaxation, which moves the code before `end`.
+static void pad_section(Assembler* assembler, I64 end, I64 alignment) {
+    Lexer* lexer   = &assembler->lexer;
+    Arena* section = &assembler->sections[assembler->section];
+    I64    size    = end - section->used;
+
+    if (assembler->section == SECTION_TEXT) {
+        Fixup* fixup = (Fixup*) lexer_push_bytes(lexer, &assembler->fixups, sizeof(Fixup));
+        *fixup       = (Fixup) {
+            .name      = lexer->lexeme_bytes,
+            .pc        = section->used,
+            .target    = end,
+            .alignment = alignment,
+            .padding   = true,
+        };
+    }
+    memset(lexer_push_bytes(lexer, section, size), 0, size);
+}
+
+static void next_directive(Assembler* assembler) {
+    Lexer* lexer = &assembler->lexer;
+    Bytes  name  = lexer->lexeme_bytes;
+
+    const Directive* directive = NULL;
+    for (I64 i = 0; i < length(directives); i++) {
+        if (bytes_equal(name, directives[i].name)) {
+            directive = &directives[i];
+        }
+    }
+    if (directive == NULL) {
+        lexer_error(lexer, "Invalid directive \"%s\".\n", name);
+    }
+
+    Arena* section = &assembler->sections[assembler->section];
+    switch (directive->type) {
+
+    case DIRECTIVE_WORD:
+        write_values(assembler, 4);
+        break;
+
+    case DIRECTIVE_HALF:
+        write_values(assembler, 2);
+        break;
+
+    case DIRECTIVE_BYTE:
+        write_values(assembler, 1);
+        break;
+
+    case DIRECTIVE_ASCII:
+        lex_string(lexer);
+        write_string(assembler);
+        break;
+
+    case DIRECTIVE_SPACE: {
+        lex_operand(lexer);
+        I64 size = parse_number(lexer, 0, INT32_MAX);
+        memset(lexer_push_bytes(lexer, section, size), 0, size);
+        break;
+    }
+
+    case DIRECTIVE_ALIGN: {
+        lex_operand(lexer);
+        I64  alignment = 1l << parse_number(lexer, 0, ALIGN_MAXIMUM_POWER);
+        I64* maximum   = &assembler->alignments[assembler->section];
+        *maximum       = max(*maximum, alignment);
+        pad_section(assembler, align_up(section->used, alignment), alignment);
+        break;
+    }
+
+    case DIRECTIVE_ORG: {
+        lex_operand(lexer);
+        I64 offset = parse_number(lexer, 0, INT32_MAX);
+        if (offset < section->used) {
+            lexer_error(lexer, "Offset is before the current one, 0x%x.\n", section->used);
+        }
+        pad_section(assembler, offset, 0);
+        break;
+    }
+
+    case DIRECTIVE_SECTION:
+        lex_operand(lexer);
+        for (I64 i = 0; i <= SECTION_COUNT; i++) {
+            if (i == SECTION_COUNT) {
+                lexer_error(lexer, "Invalid section \"%s\". Must be .text or .data.\n", lexer->lexeme_bytes);
+            }
+            if (bytes_equal(lexer->lexeme_bytes, make_bytes(section_operands[i]))) {
+                assembler->section = (Section) i;
+                break;
+            }
+        }
+        break;
+
+    default:
+        assert(false);
+
+    }
+}
+
+// Starts the next block after what is in .text so far.
+static void start_block(Assembler* assembler) {
+    assembler->block_start       = assembler->sections[SECTION_TEXT].used;
+    assembler->block_fixup_index = assembler->fixups.used / sizeof(Fixup);
+}
+
+// Ends the current block at `end`, and starts the next one.
+static void end_block(Assembler* assembler, I64 end, bool terminated) {
+    if (!assembler->find_blocks) {
+        return;
+    }
+
+    Lexer* lexer = &assembler->lexer;
+    if (end > assembler->block_start) {
+        Block* block = (Block*) lexer_push_bytes(lexer, &assembler->blocks, sizeof(Block));
+        *block       = (Block) { assembler->block_start, end, assembler->block_fixup_index, terminated };
+    }
+    start_block(assembler);
+}
+
+// Control transfers and auipc depend on their address, so they end blocks.
+static bool depends_on_address(U32 instruction) {
+    Opcode opcode = (Opcode) (instruction & 0x7F);
+    return opcode == OPCODE_BRANCH
+        || opcode == OPCODE_JAL
+        || opcode == OPCODE_JALR
+        || opcode == OPCODE_AUIPC;
+}
+
+// Ends the current block before the instructions just assembled from
+// `offset` if any of them depends on its address.
+static void end_block_before(Assembler* assembler, I64 offset) {
+    if (!assembler->find_blocks) {
+        return;
+    }
+
+    Arena* text = &assembler->sections[SECTION_TEXT];
+    for (I64 i = offset; i < text->used; i += sizeof(U32)) {
+        U32 instruction = 0;
+        memcpy(&instruction, &text->memory[i], sizeof(U32));
+        if (depends_on_address(instruction)) {
+            end_block(assembler, offset, true);
+            return;
+        }
+    }
+}
+
+// Splits the blocks at the targets of numeric branch and jal offsets, which
+// have to stay where they are just like labels do, but are only known once
+// the whole input is assembled.
+static void split_blocks(Assembler* assembler) {
+    if (!assembler->find_blocks) {
+        return;
+    }
+
+    Lexer* lexer       = &assembler->lexer;
+    I64    text_size   = assembler->sections[SECTION_TEXT].used;
+    Fixup* fixups      = (Fixup*) assembler->fixups.memory;
+    I64    fixup_count = assembler->fixups.used / sizeof(Fixup);
+    U8*    targets     = lexer_push_bytes(lexer, &assembler->arena, text_size / 4 + 1);
+    memset(targets, 0, text_size / 4 + 1);
+    for (I64 i = 0; i < fixup_count; i++) {
+        Fixup* fixup = &fixups[i];
+        if (fixup->numeric && 0 <= fixup->target && fixup->target < text_size) {
+            targets[fixup->target / 4] = 1;
+        }
+    }
+
+    I64    block_count = assembler->blocks.used / sizeof(Block);
+    Block* blocks      = (Block*) lexer_push_bytes(lexer, &assembler->arena, block_count * sizeof(Block));
+    memcpy(blocks, assembler->blocks.memory, block_count * sizeof(Block));
+    assembler->blocks.used = 0;
+    for (I64 i = 0; i < block_count; i++) {
+        Block block = blocks[i];
+        for (I64 j = block.start + 4; j < block.end; j += 4) {
+            if (targets[j / 4]) {
+                Block* first = (Block*) lexer_push_bytes(lexer, &assembler->blocks, sizeof(Block));
+                *first       = (Block) { block.start, j, block.fixup_index, false };
+                block.start  = j;
+            }
+        }
+        Block* last = (Block*) lexer_push_bytes(lexer, &assembler->blocks, sizeof(Block));
+        *last       = block;
+    }
+}
+
+static void place_blocks(Assembler* assembler) {
+    Block* blocks      = (Block*) assembler->blocks.memory;
+    I64    block_count = assembler->blocks.used / sizeof(Block);
+    for (I64 i = 0; i < block_count; i++) {
+        Block* block = &blocks[i];
+        I64    shift = relocate(assembler, block->start, block->fixup_index) - block->start;
+        block->start += shift;
+        block->end   += shift;
+    }
+}
+
+// Assembles the whole input in one pass into the sections, then lays them out
+// and resolves the labels.
+static void assemble_instructions(Assembler* assembler) {
+    Lexer* lexer = &assembler->lexer;
+    Arena* text  = &assembler->sections[SECTION_TEXT];
 
     while (lex(lexer)) {
         Bytes lexeme = lexer->lexeme_bytes;
         if (ends_with(lexeme, ":")) {
-            Label* label  = push(&labels_arena, Label);
-            label->name   = take(lexeme, -1);
-            label->offset = assembler->pc;
+            Label label = {
+                .name        = take(lexeme, -1),
+                .offset      = assembler->sections[assembler->section].used,
+                .section     = assembler->section,
+                .fixup_index = assembler->fixups.used / (I64) sizeof(Fixup),
+            };
+            if (!add_label(&assembler->labels, lexer, &assembler->arena, label)) {
+                lexer_error(lexer, "Label \"%s\" is already defined.\n", label.name);
+            }
+            end_block(assembler, text->used, false);
+        } else if (starts_with(lexeme, ".")) {
+            end_block(assembler, text->used, false);
+            next_directive(assembler);
+            start_block(assembler);
         } else {
+            if (assembler->section != SECTION_TEXT) {
+                lexer_error(lexer, "Instructions must be in .text.\n");
+            }
+            if (text->used % 4 != 0) {
+                lexer_error(lexer, "Instruction is not aligned to 4 bytes.\n");
+            }
+            I64 offset = text->used;
             next_instruction(assembler);
+            end_block_before(assembler, offset);
+        }
+    }
+    end_block(assembler, text->used, false);
+    split_blocks(assembler);
+
+    resolve_fixups(assembler);
+    place_labels(assembler);
+    resolve_references(assembler);
+    place_blocks(assembler);
+}
+
+// The memory image starts with .text at address 0, followed by .data at
+// `data_address`, and is padded to whole words. The names of the labels point
+// into the source.
+typedef struct {
+    U32*   words;
+    I64    word_count;
+    I64    text_size;
+    I64    data_address;
+    I64    data_size;
+    I64    data_alignment;
+    Label* labels; // sorted by offset, then by name
+    I64    label_count;
+    Block* blocks; // if asked for
+    I64    block_count;
+} Assembly;
+
+static int compare_labels(const void* a_pointer, const void* b_pointer) {
+    const Label* a = (const Label*) a_pointer;
+    const Label* b = (const Label*) b_pointer;
+    if (a->offset != b->offset) {
+        return a->offset < b->offset ? -1 : 1;
+    }
+    I64 size   = a->name.size < b->name.size ? a->name.size : b->name.size;
+    int result = memcmp(a->name.data, b->name.data, size);
+    if (result != 0) {
+        return result;
+    }
+    return a->name.size < b->name.size ? -1 : a->name.size > b->name.size;
+}
+
+// Copies the labels out of the hash table into `arena`, sorted.
+static Label* sort_labels(Lexer* lexer, Labels* labels, Arena* arena) {
+    Label* output = (Label*) lexer_push_bytes(lexer, arena, labels->count * sizeof(Label));
+    I64    count  = 0;
+    for (I64 i = 0; i < labels->capacity; i++) {
+        if (labels->slots[i].name.data != NULL) {
+            output[count++] = labels->slots[i];
         }
     }
+    qsort(output, count, sizeof(Label), compare_labels);
+    return output;
+}
+
+static bool try_make_arena(Arena* arena, I64 size) {
+    U8* memory = try_os_allocate(size);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+    *arena = (Arena) { NULL, memory, size };
+    return true;
+}
 
-    assembler->labels = (Labels) {
-        .data = (Label*) labels_arena.memory,
-        .size = labels_arena.used / sizeof(Label),
+static void free_arenas(Arena* arenas, I64 count) {
+    for (I64 i = 0; i < count; i++) {
+        if (arenas[i].memory != NULL) {
+            munmap(arenas[i].memory, arenas[i].size);
+        }
+    }
+}
+
+// Assembles `source` into `assembly`, whose memory image is taken from
+// `arena`. Returns false and fills `error`, whose message is taken from
+// `arena` too, if the source is invalid. If `find_blocks`, the blocks of
+// instructions that may be reordered are taken from `arena` as well.
+//
+// The labels, sections, fixups, references and blocks are built in arenas of their
+// own, which are freed before returning, so nothing but the output is left in
+// `arena`.
+static bool assemble(Bytes source, bool find_blocks, Arena* arena, Assembly* assembly, LexerError* error) {
+    // Not changed after setjmp(), so still valid after a jump.
+    Arena arenas[6] = {};
+    for (I64 i = 0; i < length(arenas); i++) {
+        if (!try_make_arena(&arenas[i], ASSEMBLER_ARENA_SIZE)) {
+            free_arenas(arenas, length(arenas));
+            *error = (LexerError) { 1, 1, make_bytes("Out of memory.\n") };
+            return false;
+        }
+    }
+
+    jmp_buf   error_jump;
+    Assembler assembler                    = {};
+    assembler.arena                        = arenas[0];
+    assembler.sections[SECTION_TEXT]       = arenas[1];
+    assembler.sections[SECTION_DATA]       = arenas[2];
+    assembler.fixups                       = arenas[3];
+    assembler.references                   = arenas[4];
+    assembler.blocks                       = arenas[5];
+    assembler.find_blocks                  = find_blocks;
+    assembler.alignments[SECTION_TEXT]     = 4;
+    assembler.alignments[SECTION_DATA]     = 4;
+
+    Lexer* lexer       = &assembler.lexer;
+    *lexer             = make_lexer(source);
+    lexer->error       = error;
+    lexer->error_arena = arena;
+    lexer->error_jump  = &error_jump;
+
+    if (setjmp(error_jump) != 0) {
+        free_arenas(arenas, length(arenas));
+        return false;
+    }
+
+    assemble_instructions(&assembler);
+
+    lexer_push_bytes(lexer, arena, -arena->used & 7); // aligns the output
+    Label* labels = sort_labels(lexer, &assembler.labels, arena);
+
+    I64    blocks_size = assembler.blocks.used;
+    Block* blocks      = (Block*) lexer_push_bytes(lexer, arena, blocks_size);
+    memcpy(blocks, assembler.blocks.memory, blocks_size);
+
+    Arena* text       = &assembler.sections[SECTION_TEXT];
+    Arena* data       = &assembler.sections[SECTION_DATA];
+    I64    image_size = align_up(assembler.data_address + data->used, sizeof(U32));
+    U8*    image      = lexer_push_bytes(lexer, arena, image_size);
+    memset(image, 0, image_size);
+    memcpy(image, text->memory, text->used);
+    memcpy(&image[assembler.data_address], data->memory, data->used);
+
+    *assembly = (Assembly) {
+        .words          = (U32*) image,
+        .word_count     = image_size / (I64) sizeof(U32),
+        .text_size      = text->used,
+        .data_address   = assembler.data_address,
+        .data_size      = data->used,
+        .data_alignment = assembler.alignments[SECTION_DATA],
+        .labels         = labels,
+        .label_count    = assembler.labels.count,
+        .blocks         = blocks,
+        .block_count    = blocks_size / (I64) sizeof(Block),
     };
+
+    free_arenas(arenas, length(arenas));
+    return true;
 }
@@ -0,0 +1,134 @@
+#include "../base/prelude.h"
+#include "../base/buffer.h"
+#include "../base/arena.h"
+#include "../base/extra.h"
+#include "lexer.h"
+#include "schemas.h"
+#include "../../output/schema_table.h"
+#include "assembler.h"
+
+static const char* help_message =
+    "Usage: assembler_benchmark [MEBIBYTES]\n"
+    "\n"
+    "       Generates MEBIBYTES (16 by default) of assembly with comments,\n"
+    "       labels and forward references, and prints how fast it is lexed\n"
+    "       and assembled.\n"
+    "\n"
+    "       --help  Prints this message.\n";
+
+static const I64 repetition_count = 3;
+
+// Every block of lines starts with a label and ends with a jump to the next one.
+static const char* block_lines[] = {
+    "    addi  x%i x%i %i\n",
+    "    add   x%i x%i x%i\n",
+    "    # Comment %i on x%i and x%i, as long as a typical one.\n",
+    "    lw    x%i x%i %i\n",
+    "    xori  x%i x%i %i\n",
+    "    sw    x%i x%i %i\n",
+    "    sltu  x%i x%i x%i # trailing comment\n",
+};
+
+static U32 next_random(U32* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Appends formatted text to the arena through a console-sized buffer.
+static void append_line(Arena* arena, Buffer* line, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    line->buffered = 0;
+    printv(line, format, arguments);
+    va_end(arguments);
+
+    memcpy(push_bytes(arena, line->buffered), line->memory, line->buffered);
+}
+
+static Bytes generate_source(Buffer* console, I64 size) {
+    Arena  arena  = make_arena(console, size + getpagesize());
+    Buffer line   = make_buffer(-1, getpagesize());
+    U32    random = 0x12345678;
+
+    I64 block = 0;
+    while (arena.used + getpagesize() < size) {
+        append_line(&arena, &line, "label_%i:\n", block);
+        for (I64 i = 0; i < length(block_lines); i++) {
+            I64 a = next_random(&random) % 32;
+            I64 b = next_random(&random) % 32;
+            I64 c = next_random(&random) % 0x800;
+            if (i == 1 || i == 6) {
+                c = c % 32;
+            }
+            append_line(&arena, &line, block_lines[i], a, b, c);
+        }
+        append_line(&arena, &line, "    jal   x0 label_%i\n", block + 1);
+        block++;
+    }
+    append_line(&arena, &line, "label_%i:\n", block);
+
+    return (Bytes) { arena.memory, arena.used };
+}
+
+static void print_speed(Buffer* console, const char* name, I64 size, F64 seconds) {
+    I64 megabytes_per_second = (I64) (size / seconds / 1e6);
+    print(console, "%s: %i ms, %i MB/s\n", make_bytes(name), (I64) (seconds * 1e3), megabytes_per_second);
+}
+
+int main(int argc, char** argv) {
+    Buffer console = make_console();
+
+    print_help(&console, argc, argv, help_message);
+
+    I64 mebibytes = 16;
+    if (argc >= 2) {
+        char* end = NULL;
+        mebibytes = strtoll(argv[1], &end, 10);
+        if (*end != 0 || mebibytes <= 0) {
+            print(&console, ERROR "Invalid size \"%s\".\n", make_bytes(argv[1]));
+            flush_and_exit(&console, EXIT_FAILURE);
+        }
+    }
+
+    Bytes source = generate_source(&console, mebibytes << 20);
+
+    F64 lex_seconds = INFINITY;
+    I64 lexemes     = 0;
+    for (I64 i = 0; i < repetition_count; i++) {
+        Lexer lexer = make_lexer(source);
+        lexemes     = 0;
+
+        F64 start = get_seconds();
+        while (lex(&lexer)) {
+            lexemes++;
+        }
+        F64 seconds = get_seconds() - start;
+        lex_seconds = seconds < lex_seconds ? seconds : lex_seconds;
+    }
+
+    F64 assemble_seconds = INFINITY;
+    I64 words            = 0;
+    Arena arena = make_arena(&console, ASSEMBLER_ARENA_SIZE);
+    for (I64 i = 0; i < repetition_count; i++) {
+        Assembly   assembly = {};
+        LexerError error    = {};
+        arena.used          = 0;
+
+        F64 start = get_seconds();
+        if (!assemble(source, false, &arena, &assembly, &error)) {
+            print(&console, ERROR "generated:%i:%i: %s", error.line, error.column, error.message);
+            flush_and_exit(&console, EXIT_FAILURE);
+        }
+        F64 seconds = get_seconds() - start;
+        assemble_seconds = seconds < assemble_seconds ? seconds : assemble_seconds;
+
+        words = assembly.word_count;
+    }
+
+    print(&console, "%i bytes, %i lexemes, %i words\n", source.size, lexemes, words);
+    print_speed(&console, "Lexing", source.size, lex_seconds);
+    print_speed(&console, "Assembling", source.size, assemble_seconds);
+    flush(&console);
+}
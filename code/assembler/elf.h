@@ -0,0 +1,216 @@
+// Writes an assembly as an ELF32 executable for RV32I, which tools like
+// objdump, gdb and trace decoders read symbols from.
+//
+// The file has one segment, loaded at address 0, holding the memory image of
+// the assembly (.text and then .data), and a symbol table with a local symbol
+// for every label. The layout is:
+//
+//   ELF header, program header, .text, .data, .symtab, .strtab, .shstrtab,
+//   section headers.
+
+#define ELF_CLASS_32          1
+#define ELF_DATA_LSB          1
+#define ELF_VERSION_CURRENT   1
+#define ELF_TYPE_EXEC         2
+#define ELF_MACHINE_RISCV     243
+#define ELF_SEGMENT_LOAD      1
+#define ELF_SEGMENT_RWX       7
+#define ELF_SECTION_PROGBITS  1
+#define ELF_SECTION_SYMTAB    2
+#define ELF_SECTION_STRTAB    3
+#define ELF_FLAG_WRITE        1
+#define ELF_FLAG_ALLOC        2
+#define ELF_FLAG_EXECINSTR    4
+#define ELF_SYMBOL_LOCAL      0
+#define ELF_SYMBOL_NOTYPE     0
+
+typedef struct {
+    U8  ident[16];
+    U16 type;
+    U16 machine;
+    U32 version;
+    U32 entry;
+    U32 program_header_offset;
+    U32 section_header_offset;
+    U32 flags;
+    U16 header_size;
+    U16 program_header_size;
+    U16 program_header_count;
+    U16 section_header_size;
+    U16 section_header_count;
+    U16 section_names_index;
+} ElfHeader;
+
+typedef struct {
+    U32 type;
+    U32 offset;
+    U32 virtual_address;
+    U32 physical_address;
+    U32 file_size;
+    U32 memory_size;
+    U32 flags;
+    U32 alignment;
+} ElfProgramHeader;
+
+typedef struct {
+    U32 name;
+    U32 type;
+    U32 flags;
+    U32 address;
+    U32 offset;
+    U32 size;
+    U32 link;
+    U32 info;
+    U32 alignment;
+    U32 entry_size;
+} ElfSectionHeader;
+
+typedef struct {
+    U32 name;
+    U32 value;
+    U32 size;
+    U8  info;
+    U8  other;
+    U16 section;
+} ElfSymbol;
+
+typedef enum {
+    ELF_SECTION_INDEX_NULL,
+    ELF_SECTION_INDEX_TEXT,
+    ELF_SECTION_INDEX_DATA,
+    ELF_SECTION_INDEX_SYMTAB,
+    ELF_SECTION_INDEX_STRTAB,
+    ELF_SECTION_INDEX_SHSTRTAB,
+    ELF_SECTION_COUNT,
+} ElfSectionIndex;
+
+// Names of the sections, at the offsets given by section_name_offsets.
+static const char   section_names[]        = "\0.text\0.data\0.symtab\0.strtab\0.shstrtab";
+static const U32    section_name_offsets[] = { 0, 1, 7, 13, 21, 29 };
+
+static bool write_padding(Buffer* output, I64 size) {
+    static const U8 zeros[8] = {};
+    return write_bytes(output, (Bytes) { (U8*) zeros, size });
+}
+
+// Returns false if writing failed.
+static bool write_elf(Buffer* output, Assembly* assembly) {
+    I64 image_size  = assembly->data_address + assembly->data_size;
+    I64 symbol_size = (assembly->label_count + 1) * sizeof(ElfSymbol);
+
+    I64 strtab_size = 1;
+    for (I64 i = 0; i < assembly->label_count; i++) {
+        strtab_size += assembly->labels[i].name.size + 1;
+    }
+
+    I64 text_offset     = sizeof(ElfHeader) + sizeof(ElfProgramHeader);
+    I64 data_offset     = text_offset + assembly->data_address;
+    I64 symtab_offset   = align_up(text_offset + image_size, 4);
+    I64 strtab_offset   = symtab_offset + symbol_size;
+    I64 shstrtab_offset = strtab_offset + strtab_size;
+    I64 headers_offset  = align_up(shstrtab_offset + sizeof(section_names), 4);
+
+    ElfHeader header = {
+        .ident                 = { 0x7F, 'E', 'L', 'F', ELF_CLASS_32, ELF_DATA_LSB, ELF_VERSION_CURRENT },
+        .type                  = ELF_TYPE_EXEC,
+        .machine               = ELF_MACHINE_RISCV,
+        .version               = ELF_VERSION_CURRENT,
+        .entry                 = 0,
+        .program_header_offset = sizeof(ElfHeader),
+        .section_header_offset = (U32) headers_offset,
+        .header_size           = sizeof(ElfHeader),
+        .program_header_size   = sizeof(ElfProgramHeader),
+        .program_header_count  = 1,
+        .section_header_size   = sizeof(ElfSectionHeader),
+        .section_header_count  = ELF_SECTION_COUNT,
+        .section_names_index   = ELF_SECTION_INDEX_SHSTRTAB,
+    };
+
+    ElfProgramHeader segment = {
+        .type             = ELF_SEGMENT_LOAD,
+        .offset           = (U32) text_offset,
+        .virtual_address  = 0,
+        .physical_address = 0,
+        .file_size        = (U32) image_size,
+        .memory_size      = (U32) image_size,
+        .flags            = ELF_SEGMENT_RWX,
+        .alignment        = 4,
+    };
+
+    bool ok = true;
+    ok      = ok && write_bytes(output, (Bytes) { (U8*) &header, sizeof(header) });
+    ok      = ok && write_bytes(output, (Bytes) { (U8*) &segment, sizeof(segment) });
+    ok      = ok && write_bytes(output, (Bytes) { (U8*) assembly->words, image_size });
+    ok      = ok && write_padding(output, symtab_offset - (text_offset + image_size));
+
+    ElfSymbol null_symbol = {};
+    ok                    = ok && write_bytes(output, (Bytes) { (U8*) &null_symbol, sizeof(null_symbol) });
+
+    U32 name_offset = 1;
+    for (I64 i = 0; i < assembly->label_count; i++) {
+        Label*    label  = &assembly->labels[i];
+        ElfSymbol symbol = {
+            .name    = name_offset,
+            .value   = (U32) label->offset,
+            .info    = ELF_SYMBOL_LOCAL << 4 | ELF_SYMBOL_NOTYPE,
+            .section = (U16) (label->section == SECTION_TEXT ? ELF_SECTION_INDEX_TEXT : ELF_SECTION_INDEX_DATA),
+        };
+        ok           = ok && write_bytes(output, (Bytes) { (U8*) &symbol, sizeof(symbol) });
+        name_offset += label->name.size + 1;
+    }
+
+    ok = ok && write_padding(output, 1);
+    for (I64 i = 0; i < assembly->label_count; i++) {
+        ok = ok && write_bytes(output, assembly->labels[i].name);
+        ok = ok && write_padding(output, 1);
+    }
+
+    ok = ok && write_bytes(output, (Bytes) { (U8*) section_names, sizeof(section_names) });
+    ok = ok && write_padding(output, headers_offset - (shstrtab_offset + sizeof(section_names)));
+
+    ElfSectionHeader sections[ELF_SECTION_COUNT] = {};
+    sections[ELF_SECTION_INDEX_TEXT] = (ElfSectionHeader) {
+        .type      = ELF_SECTION_PROGBITS,
+        .flags     = ELF_FLAG_ALLOC | ELF_FLAG_EXECINSTR,
+        .address   = 0,
+        .offset    = (U32) text_offset,
+        .size      = (U32) assembly->text_size,
+        .alignment = 4,
+    };
+    sections[ELF_SECTION_INDEX_DATA] = (ElfSectionHeader) {
+        .type      = ELF_SECTION_PROGBITS,
+        .flags     = ELF_FLAG_ALLOC | ELF_FLAG_WRITE,
+        .address   = (U32) assembly->data_address,
+        .offset    = (U32) data_offset,
+        .size      = (U32) assembly->data_size,
+        .alignment = (U32) assembly->data_alignment,
+    };
+    // All symbols are local, so the first global one would follow the last.
+    sections[ELF_SECTION_INDEX_SYMTAB] = (ElfSectionHeader) {
+        .type       = ELF_SECTION_SYMTAB,
+        .offset     = (U32) symtab_offset,
+        .size       = (U32) symbol_size,
+        .link       = ELF_SECTION_INDEX_STRTAB,
+        .info       = (U32) (assembly->label_count + 1),
+        .alignment  = 4,
+        .entry_size = sizeof(ElfSymbol),
+    };
+    sections[ELF_SECTION_INDEX_STRTAB] = (ElfSectionHeader) {
+        .type      = ELF_SECTION_STRTAB,
+        .offset    = (U32) strtab_offset,
+        .size      = (U32) strtab_size,
+        .alignment = 1,
+    };
+    sections[ELF_SECTION_INDEX_SHSTRTAB] = (ElfSectionHeader) {
+        .type      = ELF_SECTION_STRTAB,
+        .offset    = (U32) shstrtab_offset,
+        .size      = sizeof(section_names),
+        .alignment = 1,
+    };
+    for (I64 i = 0; i < ELF_SECTION_COUNT; i++) {
+        sections[i].name = section_name_offsets[i];
+    }
+
+    ok = ok && write_bytes(output, (Bytes) { (U8*) sections, sizeof(sections) });
+    return ok;
+}
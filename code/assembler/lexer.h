@@ -1,23 +1,41 @@
+#include <setjmp.h>
+
+#if defined(__SSE2__) && !defined(LEXER_NO_SIMD)
+#include <emmintrin.h>
+#define LEXER_SIMD 1
+#endif
+
+// Line and column are counted from 1. The message ends with a newline.
+typedef struct {
+    I64   line;
+    I64   column;
+    Bytes message;
+} LexerError;
+
+// The position of a lexeme is only needed for error messages, so the lexer
+// does not track lines and columns; lexer_error() counts them from the start
+// of the text instead.
+//
+// lexer_error() does not return: it fills `error`, with the message taken
+// from `error_arena`, and jumps to `error_jump`.
 typedef struct {
-    Buffer* console;
-    Bytes   path;
-    I64     line;
-    I64     column;
-    U8*     current;
-    U8*     end;
-    I64     lexeme_line;
-    I64     lexeme_column;
-    Bytes   lexeme_bytes;
+    U8*         start;
+    U8*         current;
+    U8*         end;
+    Bytes       lexeme_bytes;
+    U8*         block_end; // end of the 64 bytes that `spaces` describes
+    U64         spaces;    // bit i is set if byte i of the block is a space
+    LexerError* error;
+    Arena*      error_arena;
+    jmp_buf*    error_jump;
 } Lexer;
 
-static Lexer make_lexer(Buffer* console, Bytes path, Bytes text) {
+static Lexer make_lexer(Bytes text) {
     return (Lexer) {
-        .console = console,
-        .path    = path,
-        .line    = 1,
-        .column  = 1,
-        .current = text.data,
-        .end     = &text.data[text.size],
+        .start     = text.data,
+        .current   = text.data,
+        .end       = &text.data[text.size],
+        .block_end = text.data,
     };
 }
 
@@ -25,33 +43,64 @@ static bool lexer_done(Lexer* lexer) {
     return lexer->current == lexer->end;
 }
 
-static void lexer_step(Lexer* lexer) {
-    if (*lexer->current == '\n') {
-        lexer->line++;
-        lexer->column = 1;
-    } else {
-        lexer->column++;
-    }
-    lexer->current++;
-}
-
 static U8 lexer_current(Lexer* lexer) {
     return *lexer->current;
 }
 
-static void clear_space(Lexer* lexer) {
-    while (!lexer_done(lexer)) {
-        if (lexer_current(lexer) == '#') {
-            while (!lexer_done(lexer) && lexer_current(lexer) != '\n') {
-                lexer_step(lexer);
-            }
+#if LEXER_SIMD
+// Returns a mask with bit i set if byte i of the 64 bytes at `input` is a
+// space.
+static U64 space_mask(const U8* input) {
+    U64 mask = 0;
+    for (I64 i = 0; i < 4; i++) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*) &input[16 * i]);
+        __m128i space = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+        __m128i line  = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'));
+        mask         |= (U64) (U32) _mm_movemask_epi8(_mm_or_si128(space, line)) << (16 * i);
+    }
+    return mask;
+}
+#endif
+
+// Moves to the first byte at or after the current one that is a space if
+// `space`, or that is not one otherwise, or to the end.
+//
+// Lexemes and the spaces between them are usually a few bytes long, so the
+// space mask of a block of 64 bytes is kept and used for all of the lexemes in
+// it. Blocks are only loaded when all of their 64 bytes are before `end`, so
+// the lexer never reads past the text.
+static void skip_while(Lexer* lexer, bool space) {
+#if LEXER_SIMD
+    while (lexer->end - lexer->current >= 64) {
+        if (lexer->current >= lexer->block_end) {
+            lexer->spaces    = space_mask(lexer->current);
+            lexer->block_end = lexer->current + 64;
         }
 
-        if (!is_space(lexer_current(lexer))) {
+        I64 index = 64 - (lexer->block_end - lexer->current);
+        U64 mask  = (space ? ~lexer->spaces : lexer->spaces) >> index;
+        if (mask != 0) {
+            lexer->current += __builtin_ctzll(mask);
+            return;
+        }
+        lexer->current = lexer->block_end;
+    }
+#endif
+    while (!lexer_done(lexer) && is_space(lexer_current(lexer)) == space) {
+        lexer->current++;
+    }
+}
+
+static void clear_space(Lexer* lexer) {
+    while (true) {
+        skip_while(lexer, true);
+        if (lexer_done(lexer) || lexer_current(lexer) != '#') {
             return;
         }
 
-        lexer_step(lexer);
+        // memchr() is vectorised by the C library.
+        U8* line_end   = (U8*) memchr(lexer->current, '\n', lexer->end - lexer->current);
+        lexer->current = line_end != NULL ? line_end : lexer->end;
     }
 }
 
@@ -61,28 +110,65 @@ static bool lex(Lexer* lexer) {
         return false;
     }
 
-    U8* start            = lexer->current;
-    lexer->lexeme_line   = lexer->line;
-    lexer->lexeme_column = lexer->column;
-
-    while (!lexer_done(lexer) && !is_space(lexer_current(lexer))) {
-        lexer_step(lexer);
-    }
+    U8* start = lexer->current;
+    skip_while(lexer, false);
 
     lexer->lexeme_bytes = (Bytes) { start, lexer->current - start };
     return true;
 }
 
+// Returns the line and column (both from 1) of `position`.
+static void lexer_position(Lexer* lexer, U8* position, I64* line, I64* column) {
+    U8* line_start = lexer->start;
+    *line          = 1;
+    while (true) {
+        U8* line_end = (U8*) memchr(line_start, '\n', position - line_start);
+        if (line_end == NULL) {
+            break;
+        }
+        line_start = line_end + 1;
+        (*line)++;
+    }
+    *column = position - line_start + 1;
+}
+
+// Room for an error message besides the lexeme, which is the only argument
+// of variable size that error messages print.
+#define LEXER_ERROR_MESSAGE_SIZE 256
+
+__attribute__((noreturn))
 static void lexer_error(Lexer* lexer, const char* format, ...) {
-    va_list arguments;
-    va_start(arguments, format);
+    LexerError* error    = lexer->error;
+    U8*         position = lexer->lexeme_bytes.data != NULL ? lexer->lexeme_bytes.data : lexer->start;
+    lexer_position(lexer, position, &error->line, &error->column);
+
+    // The message is formatted into arena memory, and the unused part is
+    // given back.
+    Arena* arena   = lexer->error_arena;
+    Buffer message = { .fd = -1, .size = LEXER_ERROR_MESSAGE_SIZE + lexer->lexeme_bytes.size };
+    message.memory = try_push_bytes(arena, message.size);
+    if (message.memory != NULL) {
+        va_list arguments;
+        va_start(arguments, format);
+        printv(&message, format, arguments);
+        va_end(arguments);
+
+        arena->used    -= message.size - message.buffered;
+        error->message  = (Bytes) { message.memory, message.buffered };
+    } else {
+        error->message = make_bytes("Out of memory.\n");
+    }
 
-    Buffer* console = lexer->console;
-    print(console, ERROR "%s:%i:%i: ", lexer->path, lexer->lexeme_line, lexer->lexeme_column);
-    printv(console, format, arguments);
+    longjmp(*lexer->error_jump, 1);
+}
 
-    flush_and_exit(console, EXIT_FAILURE);
-    va_end(arguments);
+// Same as push_bytes(), but reports a full arena as an error.
+static U8* lexer_push_bytes(Lexer* lexer, Arena* arena, I64 size) {
+    U8* output = try_push_bytes(arena, size);
+    if (output == NULL) {
+        lexer_error(lexer, "Out of memory.\n");
+    }
+    return output;
 }
 
 static void lex_operand(Lexer* lexer) {
@@ -91,6 +177,37 @@ static void lex_operand(Lexer* lexer) {
     }
 }
 
+// Lexes a string in double quotes, which may contain spaces and escaped
+// quotes, into the lexeme, quotes included.
+static void lex_string(Lexer* lexer) {
+    lex_operand(lexer);
+    if (lexer->lexeme_bytes.data[0] != '"') {
+        lexer_error(lexer, "\"%s\" is not a string.\n", lexer->lexeme_bytes);
+    }
+
+    U8* start      = lexer->lexeme_bytes.data;
+    lexer->current = start + 1;
+    while (true) {
+        if (lexer_done(lexer)) {
+            lexer->lexeme_bytes = (Bytes) { start, lexer->current - start };
+            lexer_error(lexer, "Missing closing quote.\n");
+        }
+
+        U8 c = lexer_current(lexer);
+        lexer->current++;
+        if (c == '"') {
+            break;
+        }
+        if (c == '\\' && !lexer_done(lexer)) {
+            lexer->current++;
+        }
+    }
+    lexer->lexeme_bytes = (Bytes) { start, lexer->current - start };
+
+    // The space mask may describe a block after the string.
+    lexer->block_end = lexer->current;
+}
+
 static I64 try_parse_register(Lexer* lexer) {
     Bytes bytes = lexer->lexeme_bytes;
 
@@ -190,6 +307,9 @@ static I64 parse_number(Lexer* lexer, I64 minimum, I64 maximum) {
         lexer_error(lexer, "\"%s\" is not an integer.\n", lexer->lexeme_bytes);
 
     case PARSE_NUMBER_TOO_SMALL:
+        if (minimum < 0) {
+            lexer_error(lexer, "Immediate is too small. Minimum value must be -0x%x.\n", -minimum);
+        }
         lexer_error(lexer, "Immediate is too small. Minimum value must be 0x%x.\n", minimum);
 
     case PARSE_NUMBER_TOO_LARGE:
@@ -3,122 +3,204 @@
 #include "../base/arena.h"
 #include "../base/extra.h"
 #include "lexer.h"
+#include "schemas.h"
+#include "../../output/schema_table.h"
 #include "assembler.h"
+#include "scheduler.h"
+#include "elf.h"
 
 typedef enum {
     FORMAT_BINARY,
     FORMAT_ARRAY,
     FORMAT_HEX,
+    FORMAT_ELF,
 } Format;
 
 static const char* help_message =
-    "Usage: assembler [--array] [--help] [--hex] INPUT_PATH OUTPUT_PATH\n"
+    "Usage: assembler [--array] [--elf] [--help] [--hex] [--load-latency CYCLES] [--schedule]\n"
+    "                 [--symbol-map PATH] INPUT_PATH OUTPUT_PATH\n"
     "\n"
     "       Assembles the code at INPUT_PATH into flat machine code at OUTPUT_PATH.\n"
-    "       An OUTPUT_PATH of \"-\" is standard output.\n"
+    "       An OUTPUT_PATH of \"-\" is standard output. The code starts at\n"
+    "       address 0, with .text first and .data after it.\n"
     "\n"
     "       --array Output a c array.\n"
+    "       --elf   Output an ELF32 executable with a symbol for every label.\n"
     "       --help  Prints this message.\n"
-    "       --hex   Output hex instead of flat machine code.\n";
+    "       --hex   Output hex instead of flat machine code.\n"
+    "       --load-latency CYCLES\n"
+    "               Schedules for a core on which the result of a load can be\n"
+    "               used by the instruction CYCLES instructions after it\n"
+    "               without stalling (2 by default, as in a pipelined core).\n"
+    "       --schedule\n"
+    "               Reorders the instructions between labels, branch targets\n"
+    "               and control transfers to hide the latency of loads, and\n"
+    "               prints how many load-use stall cycles that removed, unless\n"
+    "               OUTPUT_PATH is standard output. The count includes the\n"
+    "               stalls of the control transfer after the instructions,\n"
+    "               but not those of the instruction after a label.\n"
+    "       --symbol-map PATH\n"
+    "               Also writes the labels to PATH, one \"ADDRESS NAME\" line\n"
+    "               per label sorted by address, with ADDRESS as 8 hex digits.\n";
 
 static void handle_write_failure(Buffer* console, char* output_path) {
     print(console, ERROR "Failed to write to \"%s\": %s.\n", make_bytes(output_path), get_error());
     flush_and_exit(console, EXIT_FAILURE);
 }
 
-int main(int argc, char** argv) {
-    Buffer console = make_console();
+static bool write_symbol_map(Buffer* output, Assembly* assembly) {
+    for (I64 i = 0; i < assembly->label_count; i++) {
+        Label* label = &assembly->labels[i];
 
-    print_help(&console, argc, argv, help_message);
+        // 20 bytes necessary for i64_to_string. Extra byte for the space.
+        U8    storage[21] = {};
+        Bytes address     = i64_to_string(label->offset, 16, storage);
+        address           = left_pad(address, '0', 8);
+        address           = append(address, " ");
 
-    I64    argument_index = 1;
-    Format output_format  = FORMAT_BINARY;
-    while (argument_index < argc - 2) {
-        char* argument = argv[argument_index];
-        if (strcmp(argument, "--array") == 0) {
-            output_format = FORMAT_ARRAY;
-        } else if (strcmp(argument, "--hex") == 0) {
-            output_format = FORMAT_HEX;    
-        } else {
-            print(&console, ERROR "Invalid option \"%s\".\n", make_bytes(argument));
-            flush_and_exit(&console, EXIT_FAILURE);
+        if (!write_bytes(output, address) || !write_bytes(output, label->name) || !write_u8(output, '\n')) {
+            return false;
         }
-        argument_index++;
     }
+    return true;
+}
 
-    if (argument_index > argc - 2) {
-        print(&console, ERROR "Missing INPUT_PATH and OUTPUT_PATH.\n");
-        flush_and_exit(&console, EXIT_FAILURE);
-    }
-
-    char* input_path  = argv[argument_index];
-    char* output_path = argv[argument_index + 1];
-
-    Bytes  input  = read_file(&console, input_path);
-    Buffer output = open_output(&console, output_path);
-
-    Bytes     path      = make_bytes(input_path);
-    Assembler assembler = {};
-
-    Lexer* lexer = &assembler.lexer;
-    *lexer       = make_lexer(&console, path, input);
-    compute_label_offsets(&assembler);
-
-    *lexer       = make_lexer(&console, path, input);
-    assembler.pc = 0;
-
-    if (output_format == FORMAT_ARRAY) {
-        if (!write_bytes(&output, make_bytes("static const U32 instructions[] = {\n"))) {
-            handle_write_failure(&console, output_path);
+static bool write_words(Buffer* output, Assembly* assembly, Format format) {
+    if (format == FORMAT_ARRAY) {
+        if (!write_bytes(output, make_bytes("static const U32 instructions[] = {\n"))) {
+            return false;
         }
     }
 
-    while (lex(lexer)) {
-        if (ends_with(lexer->lexeme_bytes, ":")) {
-            continue;
-        }
-
-        I64 instruction = next_instruction(&assembler);
+    for (I64 i = 0; i < assembly->word_count; i++) {
+        I64 word = assembly->words[i];
 
         // 20 bytes necessary for i64_to_string. Extra 2 bytes for comma and newline.
         U8    storage[22] = {};
         Bytes to_write    = {};
-        switch (output_format) {
+        switch (format) {
 
         case FORMAT_ARRAY:
-            to_write = i64_to_string(instruction, 16, storage);
+            to_write = i64_to_string(word, 16, storage);
             to_write = left_pad(to_write, '0', 8);
             to_write = prepend(to_write, "    0x");
             to_write = append(to_write, ",\n");
             break;
 
         case FORMAT_BINARY:
-            memcpy(storage, &instruction, 4);
+            memcpy(storage, &word, 4);
             to_write = (Bytes) { storage, 4 };
             break;
 
         case FORMAT_HEX:
-            to_write = i64_to_string(instruction, 16, storage);
+            to_write = i64_to_string(word, 16, storage);
             to_write = left_pad(to_write, '0', 8);
             to_write = append(to_write, "\n");
             break;
 
+        default:
+            assert(false);
+
         }
 
-        if (!write_bytes(&output, to_write)) {
-            handle_write_failure(&console, output_path);
+        if (!write_bytes(output, to_write)) {
+            return false;
         }
     }
 
-    if (output_format == FORMAT_ARRAY) {
-        if (!write_bytes(&output, make_bytes("};\n"))) {
-            handle_write_failure(&console, output_path);
+    if (format == FORMAT_ARRAY) {
+        if (!write_bytes(output, make_bytes("};\n"))) {
+            return false;
         }
     }
 
-    if (!flush(&output)) {
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Buffer console = make_console();
+
+    print_help(&console, argc, argv, help_message);
+
+    I64     argument_index  = 1;
+    Format  output_format   = FORMAT_BINARY;
+    char*   symbol_map_path = NULL;
+    bool    schedule        = false;
+    Machine machine         = pipelined_machine;
+    while (argument_index < argc - 2) {
+        char* argument = argv[argument_index];
+        if (strcmp(argument, "--array") == 0) {
+            output_format = FORMAT_ARRAY;
+        } else if (strcmp(argument, "--elf") == 0) {
+            output_format = FORMAT_ELF;
+        } else if (strcmp(argument, "--hex") == 0) {
+            output_format = FORMAT_HEX;    
+        } else if (strcmp(argument, "--schedule") == 0) {
+            schedule = true;
+        } else if (strcmp(argument, "--load-latency") == 0 && argument_index + 1 < argc - 2) {
+            argument_index++;
+            char* end            = NULL;
+            schedule             = true;
+            machine.load_latency = strtoll(argv[argument_index], &end, 10);
+            if (*end != 0 || machine.load_latency <= 0) {
+                print(&console, ERROR "Invalid load latency \"%s\".\n", make_bytes(argv[argument_index]));
+                flush_and_exit(&console, EXIT_FAILURE);
+            }
+        } else if (strcmp(argument, "--symbol-map") == 0 && argument_index + 1 < argc - 2) {
+            argument_index++;
+            symbol_map_path = argv[argument_index];
+        } else {
+            print(&console, ERROR "Invalid option \"%s\".\n", make_bytes(argument));
+            flush_and_exit(&console, EXIT_FAILURE);
+        }
+        argument_index++;
+    }
+
+    if (argument_index > argc - 2) {
+        print(&console, ERROR "Missing INPUT_PATH and OUTPUT_PATH.\n");
+        flush_and_exit(&console, EXIT_FAILURE);
+    }
+
+    char* input_path  = argv[argument_index];
+    char* output_path = argv[argument_index + 1];
+
+    Bytes  input  = read_file(&console, input_path);
+    Buffer output = open_output(&console, output_path);
+
+    Arena      arena    = make_arena(&console, ASSEMBLER_ARENA_SIZE);
+    Assembly   assembly = {};
+    LexerError error    = {};
+    if (!assemble(input, schedule, &arena, &assembly, &error)) {
+        print(&console, ERROR "%s:%i:%i: %s", make_bytes(input_path), error.line, error.column, error.message);
+        flush_and_exit(&console, EXIT_FAILURE);
+    }
+
+    I64 stalls_before = 0;
+    I64 stalls_after  = 0;
+    if (schedule) {
+        schedule_assembly(&assembly, &machine, &stalls_before, &stalls_after);
+    }
+
+    bool written = false;
+    if (output_format == FORMAT_ELF) {
+        written = write_elf(&output, &assembly);
+    } else {
+        written = write_words(&output, &assembly, output_format);
+    }
+    if (!written || !flush(&output)) {
         handle_write_failure(&console, output_path);
     }
 
+    if (schedule && strcmp(output_path, "-") != 0) {
+        print(&console, "Scheduling removed %i of %i load-use stall cycles.\n", stalls_before - stalls_after, stalls_before);
+    }
+
+    if (symbol_map_path != NULL) {
+        Buffer symbol_map = open_output(&console, symbol_map_path);
+        if (!write_symbol_map(&symbol_map, &assembly) || !flush(&symbol_map)) {
+            handle_write_failure(&console, symbol_map_path);
+        }
+    }
+
     flush(&console);
 }
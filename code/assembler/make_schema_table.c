@@ -0,0 +1,66 @@
+#include "../base/prelude.h"
+#include "../base/buffer.h"
+#include "../base/extra.h"
+#include "schemas.h"
+
+static const char* help_message =
+    "Usage: make_schema_table [OUTPUT_PATH]\n"
+    "\n"
+    "       Finds a multiplier that hashes every schema of the assembler to a\n"
+    "       different slot and generates a C header with it and the slots.\n"
+    "       Will output to standard output if OUTPUT_PATH is missing.\n";
+
+#define MAX_ATTEMPTS 1024
+
+static bool try_fill_slots(U8* slots, U64 multiplier) {
+    memset(slots, 0, SCHEMA_TABLE_SIZE);
+    for (I64 i = 0; i < length(schemas); i++) {
+        U8* slot = &slots[schema_slot(multiplier, schemas[i].operation)];
+        if (*slot != 0) {
+            return false;
+        }
+        *slot = i + 1;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Buffer console = make_console();
+
+    print_help(&console, argc, argv, help_message);
+
+    if (length(schemas) >= 256) {
+        print(&console, ERROR "Schema indices must fit into a slot.\n");
+        flush_and_exit(&console, EXIT_FAILURE);
+    }
+
+    static U8 slots[SCHEMA_TABLE_SIZE];
+    U64       multiplier = 0x9E3779B97F4A7C15;
+    I64       attempt    = 0;
+    while (!try_fill_slots(slots, multiplier)) {
+        attempt++;
+        if (attempt == MAX_ATTEMPTS) {
+            print(&console, ERROR "No perfect hash multiplier found; increase SCHEMA_TABLE_BITS.\n");
+            flush_and_exit(&console, EXIT_FAILURE);
+        }
+        multiplier = multiplier * 6364136223846793005 + 1442695040888963407;
+        multiplier = multiplier | 1;
+    }
+
+    char*  output_path = argc < 2 ? "-" : argv[1];
+    Buffer output      = open_output(&console, output_path);
+
+    print(&output, "// Generated by make_schema_table from code/assembler/schemas.h.\n\n");
+    print(&output, "static const U64 schema_multiplier = (U64) 0x%x << 32 | 0x%x;\n\n", multiplier >> 32, multiplier & 0xFFFFFFFF);
+    print(&output, "static const U8 schema_slots[SCHEMA_TABLE_SIZE] = {\n");
+    for (I64 i = 0; i < SCHEMA_TABLE_SIZE; i++) {
+        print(&output, i % 32 == 0 ? "    %i," : " %i,", (I64) slots[i]);
+        if (i % 32 == 31) {
+            write_u8(&output, '\n');
+        }
+    }
+    print(&output, "};\n");
+
+    flush(&output);
+    flush(&console);
+}
@@ -0,0 +1,203 @@
+// Reorders instructions inside basic blocks to hide the latency of loads.
+//
+// The result of a load is ready later than other results, so an instruction
+// that uses it right away stalls. The scheduler moves independent instructions
+// between the two where it can. Only the order of instructions that do not
+// depend on each other changes: an instruction stays after every earlier one
+// that writes a register it reads or writes, or that reads a register it
+// writes, and memory accesses stay in their order, since some addresses are
+// devices.
+//
+// Stalls are counted statically, with an in-order core that issues one
+// instruction per cycle, and without knowing anything about the registers at
+// the start of a block. The control transfer that ends a block stays after
+// it, and its stalls are counted with the block's, so a load is not moved
+// right before a branch on its result. The first instruction after a label is
+// reached from elsewhere too, so its stalls are not counted.
+
+// Timing of the core that the scheduler targets. The result of a load can be
+// used without stalling by the instruction `load_latency` instructions after
+// it, and an earlier one stalls for the difference. Other results can be used
+// by the next instruction.
+typedef struct {
+    I64 load_latency;
+} Machine;
+
+// Cpu.sv stalls every load for a cycle of its own, which no order hides. A
+// pipelined core with a memory stage after the execute stage also stalls an
+// instruction that uses a loaded value right after the load.
+static const Machine pipelined_machine = { .load_latency = 2 };
+
+// Dependencies within a window are bit masks, so blocks are scheduled in
+// windows of at most this many instructions.
+#define SCHEDULE_WINDOW 64
+
+typedef struct {
+    U32  reads;  // bit i set if xi is read, except x0
+    U32  writes; // bit i set if xi is written, except x0
+    bool load;
+    bool memory;
+} Operands;
+
+static Operands get_operands(U32 instruction) {
+    Opcode opcode = (Opcode) (instruction & 0x7F);
+    U32    rd     = 1u << slice_bits(instruction, 7, 11);
+    U32    rs1    = 1u << slice_bits(instruction, 15, 19);
+    U32    rs2    = 1u << slice_bits(instruction, 20, 24);
+
+    Operands operands = {};
+    switch (opcode) {
+    case OPCODE_IMM:    operands = (Operands) { rs1,       rd               }; break;
+    case OPCODE_LUI:    operands = (Operands) { 0,         rd               }; break;
+    case OPCODE_OP:     operands = (Operands) { rs1 | rs2, rd               }; break;
+    case OPCODE_LOAD:   operands = (Operands) { rs1,       rd,  true,  true }; break;
+    case OPCODE_STORE:  operands = (Operands) { rs1 | rs2, 0,   false, true }; break;
+    case OPCODE_BRANCH: operands = (Operands) { rs1 | rs2, 0                }; break;
+    case OPCODE_JALR:   operands = (Operands) { rs1,       rd               }; break;
+    case OPCODE_JAL:
+    case OPCODE_AUIPC:  operands = (Operands) { 0,         rd               }; break;
+    default:            assert(false);
+    }
+
+    operands.reads  &= ~1u;
+    operands.writes &= ~1u;
+    return operands;
+}
+
+static I64 get_latency(const Machine* machine, Operands* operands) {
+    return operands->load ? machine->load_latency : 1;
+}
+
+// Returns the cycle in which an instruction with `operands` can issue, at the
+// earliest in `cycle`, given the cycles in which the registers are ready.
+static I64 get_issue_cycle(Operands* operands, I64* ready, I64 cycle) {
+    for (I64 i = 0; i < 32; i++) {
+        if (test_bit(operands->reads, i)) {
+            cycle = max(cycle, ready[i]);
+        }
+    }
+    return cycle;
+}
+
+// Returns the stall cycles of running the instructions in `order`, followed by
+// `terminator` if it is not NULL.
+static I64 count_stalls(const Machine* machine, Operands* operands, U8* order, I64 count, Operands* terminator) {
+    I64 ready[32] = {};
+    I64 cycle     = 0;
+    for (I64 i = 0; i < count; i++) {
+        Operands* instruction = &operands[order[i]];
+        I64       issue       = get_issue_cycle(instruction, ready, cycle);
+        for (I64 j = 0; j < 32; j++) {
+            if (test_bit(instruction->writes, j)) {
+                ready[j] = issue + get_latency(machine, instruction);
+            }
+        }
+        cycle = issue + 1;
+    }
+    if (terminator != NULL) {
+        cycle = get_issue_cycle(terminator, ready, cycle) + 1;
+        count++;
+    }
+    return cycle - count;
+}
+
+// Schedules the instructions one cycle at a time: of those whose dependencies
+// are all scheduled, the one that can issue first, and of those the one with
+// the longest chain of latencies after it, or the first. The new order is only
+// kept if it stalls less, counting the stalls of `terminator`, the control
+// transfer after the instructions, if it is not NULL. Adds the stall cycles
+// before and after to `stalls_before` and `stalls_after`.
+static void schedule_window(const Machine* machine, U32* instructions, I64 count, U32* terminator, I64* stalls_before, I64* stalls_after) {
+    Operands operands[SCHEDULE_WINDOW];
+    U64      predecessors[SCHEDULE_WINDOW];
+    I64      heights[SCHEDULE_WINDOW];
+    U8       original[SCHEDULE_WINDOW];
+    U8       order[SCHEDULE_WINDOW];
+    Operands terminator_operands = {};
+    if (terminator != NULL) {
+        terminator_operands = get_operands(*terminator);
+    }
+
+    for (I64 i = 0; i < count; i++) {
+        operands[i]     = get_operands(instructions[i]);
+        predecessors[i] = 0;
+        original[i]     = i;
+        for (I64 j = 0; j < i; j++) {
+            Operands* a = &operands[j];
+            Operands* b = &operands[i];
+            if ((a->writes & (b->reads | b->writes)) || (a->reads & b->writes) || (a->memory && b->memory)) {
+                predecessors[i] |= 1ull << j;
+            }
+        }
+    }
+
+    for (I64 i = count - 1; i >= 0; i--) {
+        heights[i] = get_latency(machine, &operands[i]);
+        if (operands[i].writes & terminator_operands.reads) {
+            heights[i] = get_latency(machine, &operands[i]) + 1;
+        }
+        for (I64 j = i + 1; j < count; j++) {
+            if (test_bit(predecessors[j], i)) {
+                heights[i] = max(heights[i], get_latency(machine, &operands[i]) + heights[j]);
+            }
+        }
+    }
+
+    U64 scheduled = 0;
+    I64 ready[32] = {};
+    I64 cycle     = 0;
+    for (I64 k = 0; k < count; k++) {
+        I64 best       = -1;
+        I64 best_issue = 0;
+        for (I64 i = 0; i < count; i++) {
+            if (test_bit(scheduled, i) || (predecessors[i] & ~scheduled) != 0) {
+                continue;
+            }
+            I64 issue = get_issue_cycle(&operands[i], ready, cycle);
+            if (best == -1 || issue < best_issue || (issue == best_issue && heights[i] > heights[best])) {
+                best       = i;
+                best_issue = issue;
+            }
+        }
+
+        order[k]   = best;
+        scheduled |= 1ull << best;
+        for (I64 j = 0; j < 32; j++) {
+            if (test_bit(operands[best].writes, j)) {
+                ready[j] = best_issue + get_latency(machine, &operands[best]);
+            }
+        }
+        cycle = best_issue + 1;
+    }
+
+    Operands* last   = terminator != NULL ? &terminator_operands : NULL;
+    I64       before = count_stalls(machine, operands, original, count, last);
+    I64       after  = count_stalls(machine, operands, order, count, last);
+    if (after < before) {
+        U32 copy[SCHEDULE_WINDOW];
+        memcpy(copy, instructions, count * sizeof(U32));
+        for (I64 i = 0; i < count; i++) {
+            instructions[i] = copy[order[i]];
+        }
+    } else {
+        after = before;
+    }
+
+    *stalls_before += before;
+    *stalls_after  += after;
+}
+
+// Schedules every block of `assembly`, which must have been assembled with
+// its blocks, and adds up the stall cycles before and after.
+static void schedule_assembly(Assembly* assembly, const Machine* machine, I64* stalls_before, I64* stalls_after) {
+    for (I64 i = 0; i < assembly->block_count; i++) {
+        Block* block = &assembly->blocks[i];
+        U32*   start = &assembly->words[block->start / 4];
+        I64    count = (block->end - block->start) / 4;
+        for (I64 j = 0; j < count; j += SCHEDULE_WINDOW) {
+            I64  window     = count - j < SCHEDULE_WINDOW ? count - j : SCHEDULE_WINDOW;
+            U32* terminator = block->terminated && j + window == count ? &start[count] : NULL;
+            schedule_window(machine, &start[j], window, terminator, stalls_before, stalls_after);
+        }
+    }
+}
@@ -0,0 +1,130 @@
+typedef enum {
+    OPCODE_IMM    = 0b0010011,
+    OPCODE_LUI    = 0b0110111,
+    OPCODE_AUIPC  = 0b0010111,
+    OPCODE_OP     = 0b0110011,
+    OPCODE_JAL    = 0b1101111,
+    OPCODE_JALR   = 0b1100111,
+    OPCODE_BRANCH = 0b1100011,
+    OPCODE_LOAD   = 0b0000011,
+    OPCODE_STORE  = 0b0100011,
+} Opcode;
+
+#define FUNCT3_ADD  0b000
+#define FUNCT3_SUB  ((1 << 18) | 0b000)
+#define FUNCT3_SLL  0b001
+#define FUNCT3_SLT  0b010
+#define FUNCT3_SLTU 0b011
+#define FUNCT3_XOR  0b100
+#define FUNCT3_SRL  0b101
+#define FUNCT3_SRA  ((1 << 18) | 0b101)
+#define FUNCT3_OR   0b110
+#define FUNCT3_AND  0b111
+
+#define FUNCT3_BEQ  0b000
+#define FUNCT3_BNE  0b001
+#define FUNCT3_BLT  0b100
+#define FUNCT3_BGE  0b101
+#define FUNCT3_BLTU 0b110
+#define FUNCT3_BGEU 0b111
+
+#define FUNCT3_B   0b000
+#define FUNCT3_H   0b001
+#define FUNCT3_W   0b010
+#define FUNCT3_LBU 0b100
+#define FUNCT3_LHU 0b101
+
+// Pseudo-instructions expand to the instructions of their schema, with some
+// of the operands implied, or to a sequence of instructions.
+typedef enum {
+    PSEUDO_NONE,
+    PSEUDO_NOP,  // addi x0 x0 0
+    PSEUDO_MV,   // addi rd rs 0
+    PSEUDO_LI,   // addi, lui, or lui and addi
+    PSEUDO_LA,   // lui and addi
+    PSEUDO_J,    // jal x0 offset
+    PSEUDO_CALL, // jal x1 offset
+    PSEUDO_RET,  // jalr x0 x1 0
+    PSEUDO_BZ,   // beq or bne rs x0 offset
+} Pseudo;
+
+typedef struct {
+    Bytes  operation;
+    Opcode opcode;
+    I64    funct3;
+    Pseudo pseudo;
+} Schema;
+
+static const Schema schemas[] = {
+    { make_bytes("addi")  , OPCODE_IMM   , FUNCT3_ADD  },
+    { make_bytes("slti")  , OPCODE_IMM   , FUNCT3_SLT  },
+    { make_bytes("sltiu") , OPCODE_IMM   , FUNCT3_SLTU },
+    { make_bytes("andi")  , OPCODE_IMM   , FUNCT3_AND  },
+    { make_bytes("ori")   , OPCODE_IMM   , FUNCT3_OR   },
+    { make_bytes("xori")  , OPCODE_IMM   , FUNCT3_XOR  },
+    { make_bytes("slli")  , OPCODE_IMM   , FUNCT3_SLL  },
+    { make_bytes("srli")  , OPCODE_IMM   , FUNCT3_SRL  },
+    { make_bytes("srai")  , OPCODE_IMM   , FUNCT3_SRA  },
+    { make_bytes("lui")   , OPCODE_LUI   , 0           },
+    { make_bytes("auipc") , OPCODE_AUIPC , 0           },
+    { make_bytes("add")   , OPCODE_OP    , FUNCT3_ADD  },
+    { make_bytes("sub")   , OPCODE_OP    , FUNCT3_SUB  },
+    { make_bytes("slt")   , OPCODE_OP    , FUNCT3_SLT  },
+    { make_bytes("sltu")  , OPCODE_OP    , FUNCT3_SLTU },
+    { make_bytes("and")   , OPCODE_OP    , FUNCT3_AND  },
+    { make_bytes("or")    , OPCODE_OP    , FUNCT3_OR   },
+    { make_bytes("xor")   , OPCODE_OP    , FUNCT3_XOR  },
+    { make_bytes("sll")   , OPCODE_OP    , FUNCT3_SLL  },
+    { make_bytes("srl")   , OPCODE_OP    , FUNCT3_SRL  },
+    { make_bytes("sra")   , OPCODE_OP    , FUNCT3_SRA  },
+    { make_bytes("jal")   , OPCODE_JAL   , 0           },
+    { make_bytes("jalr")  , OPCODE_JALR  , 0           },
+    { make_bytes("beq")   , OPCODE_BRANCH, FUNCT3_BEQ  },
+    { make_bytes("bne")   , OPCODE_BRANCH, FUNCT3_BNE  },
+    { make_bytes("blt")   , OPCODE_BRANCH, FUNCT3_BLT  },
+    { make_bytes("bltu")  , OPCODE_BRANCH, FUNCT3_BLTU },
+    { make_bytes("bge")   , OPCODE_BRANCH, FUNCT3_BGE  },
+    { make_bytes("bgeu")  , OPCODE_BRANCH, FUNCT3_BGEU },
+    { make_bytes("lb")    , OPCODE_LOAD  , FUNCT3_B    },
+    { make_bytes("lh")    , OPCODE_LOAD  , FUNCT3_H    },
+    { make_bytes("lw")    , OPCODE_LOAD  , FUNCT3_W    },
+    { make_bytes("lbu")   , OPCODE_LOAD  , FUNCT3_LBU  },
+    { make_bytes("lhu")   , OPCODE_LOAD  , FUNCT3_LHU  },
+    { make_bytes("sb")    , OPCODE_STORE , FUNCT3_B    },
+    { make_bytes("sh")    , OPCODE_STORE , FUNCT3_H    },
+    { make_bytes("sw")    , OPCODE_STORE , FUNCT3_W    },
+    { make_bytes("nop")   , OPCODE_IMM   , FUNCT3_ADD  , PSEUDO_NOP  },
+    { make_bytes("mv")    , OPCODE_IMM   , FUNCT3_ADD  , PSEUDO_MV   },
+    { make_bytes("li")    , OPCODE_IMM   , FUNCT3_ADD  , PSEUDO_LI   },
+    { make_bytes("la")    , OPCODE_IMM   , FUNCT3_ADD  , PSEUDO_LA   },
+    { make_bytes("j")     , OPCODE_JAL   , 0           , PSEUDO_J    },
+    { make_bytes("call")  , OPCODE_JAL   , 0           , PSEUDO_CALL },
+    { make_bytes("ret")   , OPCODE_JALR  , 0           , PSEUDO_RET  },
+    { make_bytes("beqz")  , OPCODE_BRANCH, FUNCT3_BEQ  , PSEUDO_BZ   },
+    { make_bytes("bnez")  , OPCODE_BRANCH, FUNCT3_BNE  , PSEUDO_BZ   },
+};
+
+// Schemas are found through a perfect hash of their operation: the first 8
+// bytes of an operation (and its last 8 bytes, for longer ones) are packed into
+// a key, and the top bits of the key times a multiplier index a table of
+// slots. make_schema_table picks the first multiplier of a fixed sequence that
+// maps every schema to a different slot and writes it and the slots to
+// output/schema_table.h at build time, so a lookup costs one multiplication
+// and one comparison however many schemas there are.
+#define SCHEMA_TABLE_BITS 12
+#define SCHEMA_TABLE_SIZE (1 << SCHEMA_TABLE_BITS)
+
+static U64 schema_key(Bytes operation) {
+    U64 key = 0;
+    memcpy(&key, operation.data, operation.size < 8 ? operation.size : 8);
+    if (operation.size > 8) {
+        U64 tail = 0;
+        memcpy(&tail, &operation.data[operation.size - 8], 8);
+        key ^= (tail << 7 | tail >> 57) + operation.size;
+    }
+    return key;
+}
+
+static I64 schema_slot(U64 multiplier, Bytes operation) {
+    return (schema_key(operation) * multiplier) >> (64 - SCHEMA_TABLE_BITS);
+}
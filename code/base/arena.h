@@ -22,12 +22,21 @@ static Arena make_arena(Buffer* console, I64 size) {
 
 #define push(arena, type) ((type*) push_bytes((arena), sizeof(type)))
 
-static U8* push_bytes(Arena* arena, I64 size) {
+// Returns NULL if the arena is full.
+static U8* try_push_bytes(Arena* arena, I64 size) {
     if (arena->used + size > arena->size) {
-        print(arena->console, ERROR "Out of memory.\n");
-        flush_and_exit(arena->console, EXIT_FAILURE);
+        return NULL;
     }
     U8* output   = &arena->memory[arena->used];
     arena->used += size;
     return output;
 }
+
+static U8* push_bytes(Arena* arena, I64 size) {
+    U8* output = try_push_bytes(arena, size);
+    if (output == NULL) {
+        print(arena->console, ERROR "Out of memory.\n");
+        flush_and_exit(arena->console, EXIT_FAILURE);
+    }
+    return output;
+}
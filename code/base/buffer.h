@@ -53,8 +53,8 @@ static void flush_and_exit(Buffer* buffer, I32 exit_code) {
 }
 
 static bool write_u8(Buffer* buffer, U8 input) {
-    if (buffer->buffered == buffer->size) {
-        return flush(buffer);
+    if (buffer->buffered == buffer->size && !flush(buffer)) {
+        return false;
     }
     buffer->memory[buffer->buffered] = input;
     buffer->buffered++;
@@ -62,8 +62,14 @@ static bool write_u8(Buffer* buffer, U8 input) {
 }
 
 static bool write_bytes(Buffer* buffer, Bytes input) {
-    if (buffer->buffered + input.size > buffer->size) {
-        return flush(buffer);
+    while (buffer->buffered + input.size > buffer->size) {
+        I64 count = buffer->size - buffer->buffered;
+        memcpy(&buffer->memory[buffer->buffered], input.data, count);
+        buffer->buffered += count;
+        input             = drop(input, count);
+        if (!flush(buffer)) {
+            return false;
+        }
     }
     memcpy(&buffer->memory[buffer->buffered], input.data, input.size);
     buffer->buffered += input.size;
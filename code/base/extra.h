@@ -56,3 +56,9 @@ static Buffer open_output(Buffer* console, char* output_path) {
     }
     return make_buffer(output_fd, getpagesize());
 }
+
+static F64 get_seconds() {
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
@@ -10,6 +10,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #define INFO  "\x1b[32;1mInfo \x1b[0m "
@@ -21,7 +22,9 @@
 #define max(a, b) ((a) > (b) ? (a) : (b))
 
 typedef uint8_t  U8;
+typedef uint16_t U16;
 typedef uint32_t U32;
+typedef uint64_t U64;
 typedef int32_t  I32;
 typedef int64_t  I64;
 typedef double   F64;
@@ -78,17 +81,16 @@ static bool get_digit(U8 c, I64 base, I64* digit) {
         digit = &digit_storage;
     }
 
-    bool ok = true;
     if (is_digit(c)) {
         *digit = c - '0';
-    } else if ('a' <= c && c <= 'f' + base - 1) {
+    } else if ('a' <= c && c <= 'z') {
         *digit = c - 'a' + 10;
-    } else if ('A' <= c && c <= 'A' + base - 1) {
+    } else if ('A' <= c && c <= 'Z') {
         *digit = c - 'A' + 10;
     } else {
-        ok = false;
+        return false;
     }
-    return ok;
+    return *digit < base;
 }
 
 static Iovec make_iovec(const char* input) {
@@ -149,6 +151,11 @@ static I64 test_bit(I64 input, I64 index) {
     return (input >> index) & 1;
 }
 
+// `alignment` must be a power of two.
+static I64 align_up(I64 input, I64 alignment) {
+    return (input + alignment - 1) & -alignment;
+}
+
 static I64 slice_bits(I64 input, I64 start, I64 end) {
     I64 width = end - start + 1;
     I64 mask  = (1 << width) - 1;
@@ -0,0 +1,255 @@
+#include <cxxrtl/cxxrtl.h>
+
+#include "base/prelude.h"
+#include "base/buffer.h"
+#include "base/arena.h"
+#include "base/extra.h"
+#include "batched_cpu.h"
+#include "../output/Cpu.hpp"
+
+using cxxrtl_design::p_Cpu;
+
+static const char* help_message =
+    "Usage: batch_simulator [--check] [--cycles N] [--instances N] FIRMWARE_PATH...\n"
+    "\n"
+    "       Runs N instances of the CPU (1024 by default) side by side,\n"
+    "       instance i running the machine code at the i-th FIRMWARE_PATH\n"
+    "       modulo their count, for N cycles (10000 by default). Every\n"
+    "       instance has its own 64 KiB of memory, which repeats over the\n"
+    "       whole address space. Prints the pc and a hash of the registers\n"
+    "       of every instance, and the simulation speed.\n"
+    "\n"
+    "       --check  Also runs every instance on the generated p_Cpu and\n"
+    "                reports the instances whose state or bus accesses\n"
+    "                differ, and how much faster the batched model is.\n"
+    "\n"
+    "       --help   Prints this message.\n";
+
+// Number of instances simulated by one BatchedCpu.
+static const I64 lane_count = 32;
+
+static const I64 instance_memory_size = 1l << 16 /* 64 KiB */;
+
+// Room for the bytes of a word read at the end of the memory.
+static const I64 instance_memory_stride = instance_memory_size + 64;
+
+static I64 parse_count(Buffer* console, const char* input) {
+    char* end   = NULL;
+    I64   count = strtoll(input, &end, 10);
+    if (*end != 0 || count <= 0) {
+        print(console, ERROR "Invalid count \"%s\".\n", make_bytes(input));
+        flush_and_exit(console, EXIT_FAILURE);
+    }
+    return count;
+}
+
+static void bus_write(U8* memory, U32 address, U32 data, U32 enable) {
+    U8* bytes = &memory[address & (instance_memory_size - 1)];
+    for (I64 i = 0; i < 4; i++) {
+        if (test_bit(enable, i)) {
+            bytes[i] = data >> (8 * i);
+        }
+    }
+}
+
+static U32 bus_read(U8* memory, U32 address) {
+    return *(U32*) &memory[address & (instance_memory_size - 1)];
+}
+
+// `bus_hash` covers the bus accesses of every cycle, so that --check also
+// catches differences that leave no trace in the final state.
+typedef struct {
+    U32 pc;
+    U32 registers[32];
+    U32 bus_hash;
+} InstanceState;
+
+static const U32 bus_hash_seed = 2166136261u;
+
+static U32 hash_bus(U32 hash, U32 read_address, U32 write_address, U32 write_data, U32 write_enable) {
+    hash = (hash ^ read_address) * 16777619u;
+    if (write_enable != 0) {
+        hash = (hash ^ write_address) * 16777619u;
+        hash = (hash ^ write_data) * 16777619u;
+        hash = (hash ^ write_enable) * 16777619u;
+    }
+    return hash;
+}
+
+// Runs `count` (at most lane_count) instances, whose memories follow each
+// other from `memories` on.
+static void run_batch(U8* memories, I64 count, I64 cycle_count, InstanceState* states) {
+    static BatchedCpu<lane_count> cpu;
+    batched_cpu_reset(&cpu);
+
+    U32 read_data[lane_count] = {};
+    U32 bus_hashes[lane_count];
+    for (I64 k = 0; k < count; k++) {
+        bus_hashes[k] = bus_hash_seed;
+    }
+    for (I64 cycle = 0; cycle < cycle_count; cycle++) {
+        batched_cpu_evaluate(&cpu, cycle == 0);
+        for (I64 k = 0; k < count; k++) {
+            U8* memory    = &memories[k * instance_memory_stride];
+            read_data[k]  = bus_read(memory, cpu.read_address[k]);
+            bus_write(memory, cpu.write_address[k], cpu.write_data[k], cpu.write_enable[k]);
+            bus_hashes[k] = hash_bus(bus_hashes[k], cpu.read_address[k], cpu.write_address[k], cpu.write_data[k],
+                                     cpu.write_enable[k]);
+        }
+        batched_cpu_clock(&cpu, read_data);
+    }
+
+    for (I64 k = 0; k < count; k++) {
+        states[k].pc       = cpu.pc[k];
+        states[k].bus_hash = bus_hashes[k];
+        for (I64 i = 0; i < 32; i++) {
+            states[k].registers[i] = cpu.registers[i][k];
+        }
+    }
+}
+
+static void run_reference(U8* memory, I64 cycle_count, InstanceState* state) {
+    p_Cpu cpu;
+
+    value<1>& clock    = cpu.p_clock;
+    U32       bus_hash = bus_hash_seed;
+    for (I64 cycle = 0; cycle < cycle_count; cycle++) {
+        cpu.p_reset.set(cycle == 0);
+
+        U32 read_address  = cpu.p_read__address.get<U32>();
+        U32 write_address = cpu.p_write__address.get<U32>();
+        U32 write_data    = cpu.p_write__data.get<U32>();
+        U32 write_enable  = cpu.p_write__enable.get<U32>();
+        cpu.p_read__data  = value<32>(bus_read(memory, read_address));
+        bus_write(memory, write_address, write_data, write_enable);
+        bus_hash = hash_bus(bus_hash, read_address, write_address, write_data, write_enable);
+
+        clock.set(true);
+        cpu.step();
+
+        clock.set(false);
+        cpu.p_reset.set(false);
+        cpu.step();
+    }
+
+    state->pc       = cpu.p_pc.get<U32>();
+    state->bus_hash = bus_hash;
+    for (I64 i = 0; i < 32; i++) {
+        state->registers[i] = cpu.memory_p_registers[i].get<U32>();
+    }
+}
+
+static U32 hash_registers(InstanceState* state) {
+    U32 hash = 2166136261u;
+    for (I64 i = 0; i < 32; i++) {
+        for (I64 j = 0; j < 4; j++) {
+            hash = (hash ^ (U8) (state->registers[i] >> (8 * j))) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+int main(int argc, char** argv) {
+    Buffer console = make_console();
+
+    print_help(&console, argc, argv, help_message);
+
+    bool   check          = false;
+    I64    cycle_count    = 10000;
+    I64    instance_count = 1024;
+    char** paths          = (char**) os_allocate(&console, argc * sizeof(char*));
+    I64    path_count     = 0;
+    for (I64 i = 1; i < argc; i++) {
+        Bytes argument = make_bytes(argv[i]);
+        if (bytes_equal(argument, make_bytes("--check"))) {
+            check = true;
+        } else if (bytes_equal(argument, make_bytes("--cycles")) && i + 1 < argc) {
+            cycle_count = parse_count(&console, argv[++i]);
+        } else if (bytes_equal(argument, make_bytes("--instances")) && i + 1 < argc) {
+            instance_count = parse_count(&console, argv[++i]);
+        } else {
+            paths[path_count++] = argv[i];
+        }
+    }
+
+    if (path_count == 0) {
+        print(&console, ERROR "Missing FIRMWARE_PATH.\n");
+        flush_and_exit(&console, EXIT_FAILURE);
+    }
+
+    Bytes* firmwares = (Bytes*) os_allocate(&console, path_count * sizeof(Bytes));
+    for (I64 i = 0; i < path_count; i++) {
+        firmwares[i] = read_file(&console, paths[i]);
+        if (firmwares[i].size > instance_memory_size) {
+            print(&console, ERROR "\"%s\" does not fit into %i bytes.\n", make_bytes(paths[i]),
+                  instance_memory_size);
+            flush_and_exit(&console, EXIT_FAILURE);
+        }
+    }
+
+    I64 memories_size = instance_count * instance_memory_stride;
+    U8* memories      = os_allocate(&console, memories_size);
+    for (I64 i = 0; i < instance_count; i++) {
+        Bytes firmware = firmwares[i % path_count];
+        memcpy(&memories[i * instance_memory_stride], firmware.data, firmware.size);
+    }
+
+    // Copies of the initial memories for the reference run.
+    U8* reference_memories = NULL;
+    if (check) {
+        reference_memories = os_allocate(&console, memories_size);
+        memcpy(reference_memories, memories, memories_size);
+    }
+
+    InstanceState* states = (InstanceState*) os_allocate(&console, instance_count * sizeof(InstanceState));
+
+    F64 start = get_seconds();
+    for (I64 first = 0; first < instance_count; first += lane_count) {
+        I64 count = instance_count - first < lane_count ? instance_count - first : lane_count;
+        run_batch(&memories[first * instance_memory_stride], count, cycle_count, &states[first]);
+    }
+    F64 seconds = get_seconds() - start;
+
+    for (I64 i = 0; i < instance_count; i++) {
+        print(&console, "%i %s: pc = 0x%x, registers = 0x%x\n", i, make_bytes(paths[i % path_count]),
+              (I64) states[i].pc, (I64) hash_registers(&states[i]));
+    }
+
+    I64 instance_cycles = instance_count * cycle_count;
+    print(&console, "%i instances, %i cycles in %i ms\n", instance_count, cycle_count, (I64) (seconds * 1e3));
+    print(&console, "%i instance cycles/s\n", (I64) (instance_cycles / seconds));
+
+    if (check) {
+        I64 mismatch_count = 0;
+
+        F64 reference_start = get_seconds();
+        for (I64 i = 0; i < instance_count; i++) {
+            U8*           memory = &reference_memories[i * instance_memory_stride];
+            InstanceState state  = {};
+            run_reference(memory, cycle_count, &state);
+
+            bool same_memory = memcmp(memory, &memories[i * instance_memory_stride], instance_memory_size) == 0;
+            bool same_bus    = state.bus_hash == states[i].bus_hash;
+            if (state.pc != states[i].pc || memcmp(state.registers, states[i].registers, sizeof(state.registers)) != 0
+                || !same_memory || !same_bus) {
+                const char* memory_note = same_memory ? "" : ", memory differs";
+                const char* bus_note    = same_bus ? "" : ", bus accesses differ";
+                print(&console, ERROR "Instance %i differs from p_Cpu: pc = 0x%x, registers = 0x%x%s%s.\n", i,
+                      (I64) state.pc, (I64) hash_registers(&state), make_bytes(memory_note), make_bytes(bus_note));
+                mismatch_count++;
+            }
+        }
+        F64 reference_seconds = get_seconds() - reference_start;
+
+        I64 speedup = (I64) (reference_seconds * 10 / seconds);
+        print(&console, "%i instance cycles/s with p_Cpu, batched model is %i.%ix faster\n",
+              (I64) (instance_cycles / reference_seconds), speedup / 10, speedup % 10);
+        if (mismatch_count > 0) {
+            print(&console, ERROR "%i of %i instances differ.\n", mismatch_count, instance_count);
+            flush_and_exit(&console, EXIT_FAILURE);
+        }
+        print(&console, INFO "All instances match p_Cpu.\n");
+    }
+
+    flush(&console);
+}
@@ -0,0 +1,251 @@
+// A model of modules/Cpu.sv that simulates K independent instances at once.
+//
+// Every signal is stored as an array of K lanes (structure of arrays), and
+// every step is a loop over the lanes without data dependent control flow, so
+// the compiler turns it into SIMD code that handles 8 lanes per instruction
+// with AVX2 (16 with AVX-512). The register file is the exception, since
+// every lane accesses a different register: instead of gathering and
+// scattering, which x86 either lacks or does slowly, every register is read
+// and compared against the register number of every lane, which is still only
+// a handful of vector instructions per register.
+//
+// The model is written by hand and has to be kept in sync with Cpu.sv,
+// including its quirks: branches write their comparison result to the
+// register named by the rd bits of the instruction, shifts always take the
+// shift amount from the instruction and are never arithmetic, and jal offsets
+// are not sign extended beyond bit 29. batch_simulator --check compares the
+// model against the generated p_Cpu.
+//
+// A cycle of the harness is:
+//
+//   batched_cpu_evaluate(&cpu, reset); // computes the bus outputs
+//   ... read memory at cpu.read_address, write at cpu.write_* ...
+//   batched_cpu_clock(&cpu, read_data);
+//
+// which matches driving p_Cpu with a rising and a falling clock edge per
+// cycle, as the simulator does.
+
+#define OPCODE_IMM    0x13
+#define OPCODE_LUI    0x37
+#define OPCODE_AUIPC  0x17
+#define OPCODE_OP     0x33
+#define OPCODE_JAL    0x6F
+#define OPCODE_JALR   0x67
+#define OPCODE_BRANCH 0x63
+#define OPCODE_LOAD   0x03
+#define OPCODE_STORE  0x23
+
+#define OPERATION_ADD                  0
+#define OPERATION_SIGNED_LESS_THAN     1
+#define OPERATION_LESS_THAN            2
+#define OPERATION_AND                  3
+#define OPERATION_OR                   4
+#define OPERATION_XOR                  5
+#define OPERATION_SHIFT_LEFT           6
+#define OPERATION_SHIFT_RIGHT          7
+#define OPERATION_SIGNED_SHIFT_RIGHT   8
+#define OPERATION_EQUAL                9
+#define OPERATION_GREATER_EQUAL        10
+#define OPERATION_SIGNED_GREATER_EQUAL 11
+
+template<I64 K>
+struct BatchedCpu {
+    // State.
+    U32 pc[K];
+    U32 instruction[K];
+    U32 loading[K];
+    U32 registers[32][K];
+
+    // Outputs, computed by batched_cpu_evaluate().
+    U32 read_address[K];
+    U32 write_address[K];
+    U32 write_data[K];
+    U32 write_enable[K];
+
+    // Computed by batched_cpu_evaluate() for batched_cpu_clock().
+    U32 next_pc[K];
+    U32 register_write_data[K]; // if not loading
+
+    // Temporaries.
+    U32 rs1[K];
+    U32 rs2[K];
+    U32 rd[K];
+    U32 rs1_value[K];
+    U32 rs2_value[K];
+};
+
+template<I64 K>
+static void batched_cpu_reset(BatchedCpu<K>* cpu) {
+    memset(cpu, 0, sizeof(*cpu));
+}
+
+// Returns `condition ? a : b` for a condition of 0 or 1. It is written with a
+// mask, since GCC leaves branches in long chains of conditional expressions,
+// and then does not vectorize the loop.
+static U32 choose(U32 condition, U32 a, U32 b) {
+    U32 mask = -condition;
+    return (a & mask) | (b & ~mask);
+}
+
+static U32 sign_extend(U32 input, I64 bits) {
+    return (U32) ((I32) (input << (32 - bits)) >> (32 - bits));
+}
+
+template<I64 K>
+static void batched_cpu_read_registers(BatchedCpu<K>* cpu) {
+    for (I64 k = 0; k < K; k++) {
+        cpu->rs1[k]       = (cpu->instruction[k] >> 15) & 0x1F;
+        cpu->rs2[k]       = (cpu->instruction[k] >> 20) & 0x1F;
+        cpu->rs1_value[k] = 0;
+        cpu->rs2_value[k] = 0;
+    }
+    // x0 is always 0, so it is skipped.
+    for (U32 i = 1; i < 32; i++) {
+        for (I64 k = 0; k < K; k++) {
+            cpu->rs1_value[k] = choose(cpu->rs1[k] == i, cpu->registers[i][k], cpu->rs1_value[k]);
+            cpu->rs2_value[k] = choose(cpu->rs2[k] == i, cpu->registers[i][k], cpu->rs2_value[k]);
+        }
+    }
+}
+
+template<I64 K>
+static void batched_cpu_evaluate(BatchedCpu<K>* cpu, bool reset) {
+    batched_cpu_read_registers(cpu);
+
+    for (I64 k = 0; k < K; k++) {
+        U32 instruction = cpu->instruction[k];
+        U32 pc          = cpu->pc[k];
+        U32 loading     = cpu->loading[k];
+
+        U32 opcode = instruction & 0x7F;
+        U32 rd     = (instruction >> 7) & 0x1F;
+        U32 funct3 = (instruction >> 12) & 0x7;
+        U32 shift  = (instruction >> 20) & 0x1F;
+        U32 bit_30 = (instruction >> 30) & 1;
+
+        U32 immediate_i = sign_extend(instruction >> 20, 12);
+        U32 immediate_s = sign_extend(((instruction >> 25) << 5) | rd, 12);
+        U32 immediate_b = sign_extend(
+            (((instruction >> 31) & 1) << 12) | (((instruction >> 7) & 1) << 11) |
+            (((instruction >> 25) & 0x3F) << 5) | (((instruction >> 8) & 0xF) << 1), 13);
+        U32 immediate_u = instruction & 0xFFFFF000;
+        // Cpu.sv builds this one from 30 bits, so the top two bits are 0.
+        U32 immediate_j = sign_extend(
+            (((instruction >> 31) & 1) << 20) | (((instruction >> 12) & 0xFF) << 12) |
+            (((instruction >> 20) & 1) << 11) | (((instruction >> 21) & 0x3FF) << 1), 21) & 0x3FFFFFFF;
+
+        U32 is_imm    = opcode == OPCODE_IMM;
+        U32 is_op     = opcode == OPCODE_OP;
+        U32 is_lui    = opcode == OPCODE_LUI;
+        U32 is_auipc  = opcode == OPCODE_AUIPC;
+        U32 is_jal    = opcode == OPCODE_JAL;
+        U32 is_jalr   = opcode == OPCODE_JALR;
+        U32 is_branch = opcode == OPCODE_BRANCH;
+        U32 is_load   = opcode == OPCODE_LOAD;
+        U32 is_store  = opcode == OPCODE_STORE;
+
+        U32 rs1_value = cpu->rs1_value[k];
+        U32 rs2_value = cpu->rs2_value[k];
+
+        U32 uses_rs1 = is_imm | is_op | is_lui | is_jalr | is_branch | is_load | is_store;
+        U32 operand0 = choose(uses_rs1, rs1_value, choose(is_auipc, pc, 0));
+
+        U32 operand1 = 0;
+        operand1     = choose(is_imm | is_jalr | is_load, immediate_i, operand1);
+        operand1     = choose(is_lui | is_auipc, immediate_u, operand1);
+        operand1     = choose(is_op, choose(bit_30, -rs2_value, rs2_value), operand1);
+        operand1     = choose(is_branch, rs2_value, operand1);
+        operand1     = choose(is_store, immediate_s, operand1);
+
+        U32 alu_operation = OPERATION_ADD;
+        alu_operation     = choose(funct3 == 1, OPERATION_SHIFT_LEFT, alu_operation);
+        alu_operation     = choose(funct3 == 2, OPERATION_SIGNED_LESS_THAN, alu_operation);
+        alu_operation     = choose(funct3 == 3, OPERATION_LESS_THAN, alu_operation);
+        alu_operation     = choose(funct3 == 4, OPERATION_XOR, alu_operation);
+        alu_operation     = choose(funct3 == 5, OPERATION_SHIFT_RIGHT + bit_30, alu_operation);
+        alu_operation     = choose(funct3 == 6, OPERATION_OR, alu_operation);
+        alu_operation     = choose(funct3 == 7, OPERATION_AND, alu_operation);
+
+        U32 branch_operation = OPERATION_ADD;
+        branch_operation     = choose(funct3 == 0, OPERATION_EQUAL, branch_operation);
+        branch_operation     = choose(funct3 == 1, OPERATION_XOR, branch_operation);
+        branch_operation     = choose(funct3 == 4, OPERATION_LESS_THAN, branch_operation);
+        branch_operation     = choose(funct3 == 5, OPERATION_GREATER_EQUAL, branch_operation);
+        branch_operation     = choose(funct3 == 6, OPERATION_SIGNED_LESS_THAN, branch_operation);
+        branch_operation     = choose(funct3 == 7, OPERATION_SIGNED_GREATER_EQUAL, branch_operation);
+
+        U32 operation = OPERATION_ADD;
+        operation     = choose(is_imm | is_op, alu_operation, operation);
+        operation     = choose(is_branch, branch_operation, operation);
+
+        I32 signed0 = (I32) operand0;
+        I32 signed1 = (I32) operand1;
+        U32 output  = operand0 + operand1;
+        output      = choose(operation == OPERATION_SIGNED_LESS_THAN, signed0 < signed1, output);
+        output      = choose(operation == OPERATION_LESS_THAN, operand0 < operand1, output);
+        output      = choose(operation == OPERATION_AND, operand0 & operand1, output);
+        output      = choose(operation == OPERATION_OR, operand0 | operand1, output);
+        output      = choose(operation == OPERATION_XOR, operand0 ^ operand1, output);
+        output      = choose(operation == OPERATION_SHIFT_LEFT, operand0 << shift, output);
+        output      = choose(operation == OPERATION_SHIFT_RIGHT, operand0 >> shift, output);
+        // `$signed(operand0) >> shift_amount` in Cpu.sv is a logical shift.
+        output      = choose(operation == OPERATION_SIGNED_SHIFT_RIGHT, operand0 >> shift, output);
+        output      = choose(operation == OPERATION_EQUAL, operand0 == operand1, output);
+        output      = choose(operation == OPERATION_GREATER_EQUAL, operand0 >= operand1, output);
+        output      = choose(operation == OPERATION_SIGNED_GREATER_EQUAL, signed0 >= signed1, output);
+
+        U32 take_branch = is_branch & (output != 0);
+
+        U32 offset = 4;
+        offset     = choose(take_branch, immediate_b, offset);
+        offset     = choose(is_jal, immediate_j, offset);
+        offset     = choose(is_load & !loading, 0, offset);
+
+        U32 target_address = choose(is_jalr, output & ~1u, pc + offset);
+        U32 next_pc        = choose(reset, 0, target_address);
+
+        U32 write_enable = choose((funct3 & 3) == 0, 0x1, choose((funct3 & 3) == 1, 0x3, 0xF));
+        write_enable     = choose((funct3 & 3) == 3, 0, write_enable);
+
+        U32 register_write_data = choose(is_jal | is_jalr, pc + 4, output);
+        register_write_data     = choose(rd == 0, 0, register_write_data);
+
+        cpu->next_pc[k]             = next_pc;
+        cpu->register_write_data[k] = register_write_data;
+        cpu->read_address[k]        = choose(is_load, output, next_pc);
+        cpu->write_address[k]       = output;
+        cpu->write_data[k]          = rs2_value;
+        cpu->write_enable[k]        = choose(is_store, write_enable, 0);
+    }
+}
+
+template<I64 K>
+static void batched_cpu_clock(BatchedCpu<K>* cpu, const U32* read_data) {
+    // The register file is written first, since it is indexed by the old
+    // instruction. Stores write to no register, which is register 32 here, and
+    // x0 is skipped because it is only ever written with 0.
+    for (I64 k = 0; k < K; k++) {
+        U32 instruction = cpu->instruction[k];
+        U32 opcode      = instruction & 0x7F;
+        U32 rd          = (instruction >> 7) & 0x1F;
+        U32 is_jump     = (opcode == OPCODE_JAL) | (opcode == OPCODE_JALR);
+
+        cpu->rd[k] = choose(opcode == OPCODE_STORE, 32, rd);
+        cpu->register_write_data[k] =
+            choose(cpu->loading[k] & !is_jump & (rd != 0), read_data[k], cpu->register_write_data[k]);
+    }
+    for (U32 i = 1; i < 32; i++) {
+        for (I64 k = 0; k < K; k++) {
+            cpu->registers[i][k] = choose(cpu->rd[k] == i, cpu->register_write_data[k], cpu->registers[i][k]);
+        }
+    }
+
+    for (I64 k = 0; k < K; k++) {
+        U32 instruction = cpu->instruction[k];
+        U32 is_load     = (instruction & 0x7F) == OPCODE_LOAD;
+
+        cpu->instruction[k] = choose(is_load & !cpu->loading[k], instruction, read_data[k]);
+        cpu->loading[k]     = is_load;
+        cpu->pc[k]          = cpu->next_pc[k];
+    }
+}
@@ -0,0 +1,86 @@
+#include <cxxrtl/cxxrtl.h>
+
+#include "base/prelude.h"
+#include "base/buffer.h"
+#include "base/arena.h"
+#include "base/extra.h"
+#include "../output/Cpu.hpp"
+
+using cxxrtl_design::p_Cpu;
+
+static const char* help_message =
+    "Usage: benchmark FIRMWARE_PATH [CYCLES]\n"
+    "\n"
+    "       Runs the machine code at FIRMWARE_PATH for CYCLES cycles\n"
+    "       (1000000 by default) without writing any waveforms, and\n"
+    "       prints the simulation speed.\n"
+    "\n"
+    "       --help   Prints this message.\n";
+
+int main(int argc, char** argv) {
+    Buffer console = make_console();
+
+    print_help(&console, argc, argv, help_message);
+
+    if (argc < 2) {
+        print(&console, ERROR "Missing FIRMWARE_PATH.\n");
+        flush_and_exit(&console, EXIT_FAILURE);
+    }
+
+    I64 cycle_count = 1000000;
+    if (argc >= 3) {
+        char* end   = NULL;
+        cycle_count = strtoll(argv[2], &end, 10);
+        if (*end != 0 || cycle_count <= 0) {
+            print(&console, ERROR "Invalid number of cycles \"%s\".\n", make_bytes(argv[2]));
+            flush_and_exit(&console, EXIT_FAILURE);
+        }
+    }
+
+    Bytes firmware = read_file(&console, argv[1]);
+
+    Bytes memory = {};
+    memory.size  = 1l << 20 /* 1 MiB */;
+    memory.data  = os_allocate(&console, memory.size);
+    if (firmware.size > memory.size) {
+        print(&console, ERROR "Firmware does not fit into %i bytes.\n", memory.size);
+        flush_and_exit(&console, EXIT_FAILURE);
+    }
+    memcpy(memory.data, firmware.data, firmware.size);
+
+    p_Cpu cpu;
+
+    F64 start = get_seconds();
+
+    value<1>& clock = cpu.p_clock;
+    for (I64 cycle = 0; cycle < cycle_count; cycle++) {
+        cpu.p_reset.set(cycle == 0);
+
+        U32 read_address = cpu.p_read__address.get<U32>() % (memory.size - 3);
+        U32 read_data    = *(U32*) &memory.data[read_address];
+        cpu.p_read__data = value<32>(read_data);
+
+        U32 write_address = cpu.p_write__address.get<U32>() % (memory.size - 3);
+        U32 write_data    = cpu.p_write__data.get<U32>();
+        U32 write_enable  = cpu.p_write__enable.get<U32>();
+        for (I64 i = 0; i < 4; i++) {
+            if (test_bit(write_enable, i)) {
+                memory.data[write_address + i] = write_data >> (8 * i);
+            }
+        }
+
+        clock.set(true);
+        cpu.step();
+
+        clock.set(false);
+        cpu.p_reset.set(false);
+        cpu.step();
+    }
+
+    F64 seconds = get_seconds() - start;
+
+    print(&console, "%i cycles in %i ms\n", cycle_count, (I64) (seconds * 1e3));
+    print(&console, "%i cycles/s\n", (I64) (cycle_count / seconds));
+    print(&console, "%i ns/cycle\n", (I64) (seconds * 1e9 / cycle_count));
+    flush(&console);
+}
@@ -0,0 +1,202 @@
+// Co-simulation protocol between the simulator and an external driver
+// process, such as a peripheral model.
+//
+// The simulator creates a shared memory object (/dev/shm/NAME on Linux)
+// holding a `Cosim` and waits for a driver to attach to it. Bus accesses of
+// the CPU that fall into the MMIO window [mmio_base, mmio_base + mmio_size)
+// are then sent to the driver through the `requests` ring:
+//
+//   COSIM_READ   The driver must answer with a COSIM_READ_DATA message on
+//                the `responses` ring before the simulation continues. The
+//                CPU drives its read port every cycle, so the same address
+//                may be read several times in a row.
+//   COSIM_WRITE  Posted; the simulation continues without waiting. `enable`
+//                has bit i set if byte i of `data` is written.
+//   COSIM_EXIT   The simulation has finished.
+//
+// Every message carries the cycle it was sent in. Both rings are single
+// producer, single consumer queues of fixed size messages. The layout only
+// uses fixed size integers, so a driver in another language can map the
+// object and access it directly; `head` and `tail` count messages and wrap
+// around at 2^32, and the message for a count is at `count % COSIM_RING_SIZE`.
+//
+// A side waiting for the other one first spins, since a driver usually
+// answers within a microsecond, and then sleeps on a futex on the word it is
+// waiting for. It sets the matching `*_waiting` word while it sleeps, and the
+// other side only makes the wake up system call if that word is set, so a
+// busy co-simulation makes no system calls at all.
+
+#include <sys/syscall.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#endif
+
+#define COSIM_MAGIC      0x4D49534F // "OSIM"
+#define COSIM_VERSION    1
+#define COSIM_RING_SIZE  1024
+#define COSIM_SPIN_COUNT 128
+
+typedef enum {
+    COSIM_READ      = 1,
+    COSIM_READ_DATA = 2,
+    COSIM_WRITE     = 3,
+    COSIM_EXIT      = 4,
+} CosimKind;
+
+typedef struct {
+    U32 kind;
+    U32 address;
+    U32 data;
+    U32 enable;
+    I64 cycle;
+} CosimMessage;
+
+// The words written by each side are kept on separate cache lines.
+typedef struct {
+    U32          head;             // written by the producer
+    U32          consumer_waiting; // written by the consumer
+    U8           padding_0[56];
+    U32          tail;             // written by the consumer
+    U32          producer_waiting; // written by the producer
+    U8           padding_1[56];
+    CosimMessage messages[COSIM_RING_SIZE];
+} CosimRing;
+
+typedef struct {
+    U32       magic;
+    U32       version;
+    U32       mmio_base;
+    U32       mmio_size;
+    U32       driver_attached;  // set to 1 by the driver
+    U32       simulator_waiting;
+    U8        padding[40];
+    CosimRing requests;  // simulator to driver
+    CosimRing responses; // driver to simulator
+} Cosim;
+
+static void cosim_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+static void cosim_futex_wait(U32* word, U32 value) {
+#if defined(__linux__)
+    syscall(SYS_futex, word, FUTEX_WAIT, value, NULL, NULL, 0);
+#else
+    (void) word, (void) value;
+    usleep(10);
+#endif
+}
+
+static void cosim_futex_wake(U32* word) {
+#if defined(__linux__)
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+    (void) word;
+#endif
+}
+
+// Waits until `*word != value` and returns the new value.
+static U32 cosim_wait(U32* word, U32 value, U32* waiting) {
+    for (I64 i = 0; i < COSIM_SPIN_COUNT; i++) {
+        U32 current = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+        if (current != value) {
+            return current;
+        }
+        cosim_pause();
+    }
+
+    while (true) {
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        U32 current = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+        if (current != value) {
+            __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+            return current;
+        }
+        cosim_futex_wait(word, value);
+    }
+}
+
+// Stores `value` into `*word` and wakes the other side if it is sleeping on it.
+static void cosim_publish(U32* word, U32 value, U32* waiting) {
+    __atomic_store_n(word, value, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        cosim_futex_wake(word);
+    }
+}
+
+static void cosim_send(CosimRing* ring, CosimMessage message) {
+    U32 head = ring->head;
+    U32 tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    while (head - tail == COSIM_RING_SIZE) {
+        tail = cosim_wait(&ring->tail, tail, &ring->producer_waiting);
+    }
+    ring->messages[head % COSIM_RING_SIZE] = message;
+    cosim_publish(&ring->head, head + 1, &ring->consumer_waiting);
+}
+
+static CosimMessage cosim_receive(CosimRing* ring) {
+    U32 tail = ring->tail;
+    U32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        cosim_wait(&ring->head, tail, &ring->consumer_waiting);
+    }
+    CosimMessage message = ring->messages[tail % COSIM_RING_SIZE];
+    cosim_publish(&ring->tail, tail + 1, &ring->producer_waiting);
+    return message;
+}
+
+static Cosim* cosim_map(Buffer* console, const char* name, I32 flags) {
+    I32 fd = shm_open(name, flags, 0600);
+    if (fd == -1) {
+        print(console, ERROR "Failed to open shared memory \"%s\": %s.\n", make_bytes(name), get_error());
+        flush_and_exit(console, EXIT_FAILURE);
+    }
+    if ((flags & O_CREAT) && ftruncate(fd, sizeof(Cosim)) == -1) {
+        print(console, ERROR "Failed to resize shared memory \"%s\": %s.\n", make_bytes(name), get_error());
+        flush_and_exit(console, EXIT_FAILURE);
+    }
+
+    Cosim* cosim = (Cosim*) mmap(NULL, sizeof(Cosim), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (cosim == MAP_FAILED) {
+        print(console, ERROR "Failed to memory map \"%s\": %s.\n", make_bytes(name), get_error());
+        flush_and_exit(console, EXIT_FAILURE);
+    }
+    close(fd);
+    return cosim;
+}
+
+// Creates the shared memory object `name` (which must start with a slash),
+// replacing any stale one left behind by a previous run.
+static Cosim* cosim_create(Buffer* console, const char* name, U32 mmio_base, U32 mmio_size) {
+    shm_unlink(name);
+    Cosim* cosim     = cosim_map(console, name, O_RDWR | O_CREAT | O_EXCL);
+    cosim->mmio_base = mmio_base;
+    cosim->mmio_size = mmio_size;
+    cosim->version   = COSIM_VERSION;
+    __atomic_store_n(&cosim->magic, COSIM_MAGIC, __ATOMIC_RELEASE);
+    return cosim;
+}
+
+static void cosim_wait_for_driver(Cosim* cosim) {
+    cosim_wait(&cosim->driver_attached, 0, &cosim->simulator_waiting);
+}
+
+// Used by drivers written in C.
+static Cosim* cosim_attach(Buffer* console, const char* name) {
+    Cosim* cosim = cosim_map(console, name, O_RDWR);
+    if (__atomic_load_n(&cosim->magic, __ATOMIC_ACQUIRE) != COSIM_MAGIC || cosim->version != COSIM_VERSION) {
+        print(console, ERROR "\"%s\" is not a co-simulation of version %i.\n", make_bytes(name),
+              (I64) COSIM_VERSION);
+        flush_and_exit(console, EXIT_FAILURE);
+    }
+    cosim_publish(&cosim->driver_attached, 1, &cosim->simulator_waiting);
+    return cosim;
+}
+
+static bool cosim_contains(Cosim* cosim, U32 address) {
+    return address - cosim->mmio_base < cosim->mmio_size;
+}
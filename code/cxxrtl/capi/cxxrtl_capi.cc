@@ -48,6 +48,7 @@ cxxrtl_handle cxxrtl_create_at(cxxrtl_toplevel design, const char *top_path_) {
 	cxxrtl_handle handle = new _cxxrtl_handle;
 	handle->module = std::move(design->module);
 	handle->module->debug_info(&handle->objects, nullptr, top_path);
+	handle->objects.build_index();
 	delete design;
 	return handle;
 }
@@ -73,11 +74,11 @@ size_t cxxrtl_step(cxxrtl_handle handle) {
 }
 
 struct cxxrtl_object *cxxrtl_get_parts(cxxrtl_handle handle, const char *name, size_t *parts) {
-	auto it = handle->objects.table.find(name);
-	if (it == handle->objects.table.end())
+	std::vector<cxxrtl::debug_item> *object = handle->objects.find(name);
+	if (object == nullptr)
 		return nullptr;
-	*parts = it->second.size();
-	return static_cast<cxxrtl_object*>(&it->second[0]);
+	*parts = object->size();
+	return static_cast<cxxrtl_object*>(&(*object)[0]);
 }
 
 void cxxrtl_enum(cxxrtl_handle handle, void *data,
@@ -87,10 +88,83 @@ void cxxrtl_enum(cxxrtl_handle handle, void *data,
 		callback(data, it.first.c_str(), static_cast<cxxrtl_object*>(&it.second[0]), it.second.size());
 }
 
+void cxxrtl_enum_scope(cxxrtl_handle handle, const char *scope, void *data,
+                       void (*callback)(void *data, const char *name,
+                                        cxxrtl_object *object, size_t parts)) {
+	auto range = handle->objects.scope_range(scope);
+	for (auto it = range.first; it != range.second; ++it)
+		callback(data, it->first.c_str(), static_cast<cxxrtl_object*>(&it->second[0]), it->second.size());
+}
+
 void cxxrtl_outline_eval(cxxrtl_outline outline) {
 	outline->eval();
 }
 
+struct _cxxrtl_batch {
+	struct transfer {
+		uint32_t *data;
+		size_t chunks;
+	};
+
+	cxxrtl_handle handle;
+	std::vector<transfer> inputs;
+	std::vector<transfer> outputs;
+	size_t input_chunks = 0;
+	size_t output_chunks = 0;
+	std::vector<cxxrtl_outline> outlines; // distinct outlines of the outputs, evaluated once per step
+};
+
+cxxrtl_batch cxxrtl_batch_create(cxxrtl_handle handle,
+                                 cxxrtl_object *const *inputs, size_t num_inputs,
+                                 cxxrtl_object *const *outputs, size_t num_outputs) {
+	cxxrtl_batch batch = new _cxxrtl_batch;
+	batch->handle = handle;
+	for (size_t index = 0; index < num_inputs; index++) {
+		cxxrtl_object *object = inputs[index];
+		assert(object->flags & CXXRTL_INPUT);
+		size_t chunks = ((object->width + 31) / 32) * object->depth;
+		batch->inputs.push_back({object->next ? object->next : object->curr, chunks});
+		batch->input_chunks += chunks;
+	}
+	for (size_t index = 0; index < num_outputs; index++) {
+		cxxrtl_object *object = outputs[index];
+		size_t chunks = ((object->width + 31) / 32) * object->depth;
+		batch->outputs.push_back({object->curr, chunks});
+		batch->output_chunks += chunks;
+		if (object->outline && std::find(batch->outlines.begin(), batch->outlines.end(), object->outline) ==
+				batch->outlines.end())
+			batch->outlines.push_back(object->outline);
+	}
+	return batch;
+}
+
+void cxxrtl_batch_destroy(cxxrtl_batch batch) {
+	delete batch;
+}
+
+size_t cxxrtl_batch_input_chunks(cxxrtl_batch batch) {
+	return batch->input_chunks;
+}
+
+size_t cxxrtl_batch_output_chunks(cxxrtl_batch batch) {
+	return batch->output_chunks;
+}
+
+size_t cxxrtl_batch_step(cxxrtl_batch batch, const uint32_t *inputs, uint32_t *outputs) {
+	for (auto &input : batch->inputs) {
+		memcpy(input.data, inputs, input.chunks * sizeof(uint32_t));
+		inputs += input.chunks;
+	}
+	size_t deltas = batch->handle->module->step();
+	for (auto outline : batch->outlines)
+		outline->eval();
+	for (auto &output : batch->outputs) {
+		memcpy(outputs, output.data, output.chunks * sizeof(uint32_t));
+		outputs += output.chunks;
+	}
+	return deltas;
+}
+
 int cxxrtl_attr_type(cxxrtl_attr_set attrs_, const char *name) {
 	auto attrs = (cxxrtl::metadata_map*)attrs_;
 	if (!attrs->count(name))
@@ -308,6 +308,16 @@ void cxxrtl_enum(cxxrtl_handle handle, void *data,
                  void (*callback)(void *data, const char *name,
                                   struct cxxrtl_object *object, size_t parts));
 
+// Enumerate simulated objects within a scope.
+//
+// Same as `cxxrtl_enum`, but only for the objects in the scope `scope` and its sub-scopes, that is,
+// the objects whose full hierarchical name starts with `scope` followed by a space. If `scope` is
+// an empty string, this function is the same as `cxxrtl_enum`. Objects are enumerated in the order
+// of their names. The time it takes does not depend on the number of objects outside of the scope.
+void cxxrtl_enum_scope(cxxrtl_handle handle, const char *scope, void *data,
+                       void (*callback)(void *data, const char *name,
+                                        struct cxxrtl_object *object, size_t parts));
+
 // Opaque reference to an outline.
 //
 // An outline is a group of outline objects that are evaluated simultaneously. The identity of
@@ -322,6 +332,52 @@ typedef struct _cxxrtl_outline *cxxrtl_outline;
 // re-evaluated, otherwise the bits read from that object are meaningless.
 void cxxrtl_outline_eval(cxxrtl_outline outline);
 
+// Opaque reference to a batch.
+//
+// A batch is a list of input objects and a list of output objects of a design that are accessed
+// together, once per simulation step, through packed buffers. This allows a harness written in
+// another language to drive the design with one call across the language boundary per step
+// instead of one per object.
+//
+// The packed buffer for a list of objects is the concatenation of the `curr` arrays of all of
+// the objects in the list, in order. That is, each object occupies `((width + 31) / 32) * depth`
+// 32-bit chunks, with the same padding rules as in `cxxrtl_object`.
+typedef struct _cxxrtl_batch *cxxrtl_batch;
+
+// Create a batch.
+//
+// The `inputs` array contains `num_inputs` objects of `handle` whose value is set by
+// `cxxrtl_batch_step`, and the `outputs` array contains `num_outputs` objects of `handle` whose
+// value is retrieved by it. Objects are usually obtained with `cxxrtl_get`; every part of
+// a multi-part object has to be listed separately. Input objects must have the `CXXRTL_INPUT`
+// flag set. The arrays are not used after this function returns.
+cxxrtl_batch cxxrtl_batch_create(cxxrtl_handle handle,
+                                 struct cxxrtl_object *const *inputs, size_t num_inputs,
+                                 struct cxxrtl_object *const *outputs, size_t num_outputs);
+
+// Destroy a batch.
+//
+// The design the batch was created for is not affected.
+void cxxrtl_batch_destroy(cxxrtl_batch batch);
+
+// Retrieve the size of the packed input buffer of a batch, in 32-bit chunks.
+size_t cxxrtl_batch_input_chunks(cxxrtl_batch batch);
+
+// Retrieve the size of the packed output buffer of a batch, in 32-bit chunks.
+size_t cxxrtl_batch_output_chunks(cxxrtl_batch batch);
+
+// Set the inputs, step the design, and retrieve the outputs.
+//
+// The inputs are copied from `inputs`, which must be `cxxrtl_batch_input_chunks(batch)` chunks
+// long, into the input objects (through `next` if it is not NULL, and through `curr` otherwise).
+// Then the design is simulated to a fixed point as if by `cxxrtl_step`, and the outputs are
+// copied into `outputs`, which must be `cxxrtl_batch_output_chunks(batch)` chunks long. Outline
+// objects among the outputs are evaluated before being copied. Either buffer may be NULL if
+// the corresponding list of objects is empty.
+//
+// Returns the number of delta cycles.
+size_t cxxrtl_batch_step(cxxrtl_batch batch, const uint32_t *inputs, uint32_t *outputs);
+
 // Opaque reference to an attribute set.
 //
 // An attribute set is a map between attribute names (always strings) and values (which may have
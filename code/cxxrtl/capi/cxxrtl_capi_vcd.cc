@@ -40,6 +40,10 @@ void cxxrtl_vcd_timescale(cxxrtl_vcd vcd, int number, const char *unit) {
 	vcd->writer.timescale(number, unit);
 }
 
+void cxxrtl_vcd_threads(cxxrtl_vcd vcd, size_t count) {
+	vcd->writer.threads(count);
+}
+
 void cxxrtl_vcd_add(cxxrtl_vcd vcd, const char *name, cxxrtl_object *object) {
 	// Note the copy. We don't know whether `object` came from a design (in which case it is
 	// an instance of `debug_item`), or from user code (in which case it is an instance of
@@ -50,6 +50,15 @@ void cxxrtl_vcd_destroy(cxxrtl_vcd vcd);
 // Timescale can only be set before the first call to `cxxrtl_vcd_sample`.
 void cxxrtl_vcd_timescale(cxxrtl_vcd vcd, int number, const char *unit);
 
+// Set the number of threads used to encode samples.
+//
+// The scheduled objects are split into `count` partitions that are encoded concurrently, and
+// the encoded partitions are concatenated in a deterministic order. The resulting data is
+// identical to the data written by a single thread.
+//
+// Threads can only be set before the first call to `cxxrtl_vcd_sample`.
+void cxxrtl_vcd_threads(cxxrtl_vcd vcd, size_t count);
+
 // Schedule a specific CXXRTL object to be sampled.
 //
 // The `name` is a full hierarchical name as described for `cxxrtl_get`; it does not need to match
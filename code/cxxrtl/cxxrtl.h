@@ -823,18 +823,20 @@ std::ostream &operator<<(std::ostream &os, const wire<Bits> &val) {
 	return os;
 }
 
-template<size_t Width>
+// The `Ports` parameter is the number of writes that can be queued per delta cycle without allocating; it should be
+// the number of write ports of the memory, but any number of writes is handled correctly.
+template<size_t Width, size_t Ports = 2>
 struct memory {
 	const size_t depth;
 	std::unique_ptr<value<Width>[]> data;
 
 	explicit memory(size_t depth) : depth(depth), data(new value<Width>[depth]) {}
 
-	memory(const memory<Width> &) = delete;
-	memory<Width> &operator=(const memory<Width> &) = delete;
+	memory(const memory<Width, Ports> &) = delete;
+	memory<Width, Ports> &operator=(const memory<Width, Ports> &) = delete;
 
-	memory(memory<Width> &&) = default;
-	memory<Width> &operator=(memory<Width> &&other) {
+	memory(memory<Width, Ports> &&) = default;
+	memory<Width, Ports> &operator=(memory<Width, Ports> &&other) {
 		assert(depth == other.depth);
 		data = std::move(other.data);
 		write_queue = std::move(other.write_queue);
@@ -866,21 +868,70 @@ struct memory {
 	// the writes during the commit phase in the priority order. This approach has low overhead, with both space
 	// and time proportional to the amount of write ports. Because virtually every memory in a practical design
 	// has at most two write ports, linear search is used on every write, being the fastest and simplest approach.
+	//
+	// Each write port queues at most one write per delta cycle, so the buffer is stored inline with room for
+	// `Ports` writes, and updating a memory from generated code never touches the heap. Writes beyond that (e.g.
+	// if `Ports` is too small, or a testbench queues writes of its own) spill into a vector, which is only used
+	// until the next commit but keeps its capacity.
 	struct write {
 		size_t index;
 		value<Width> val;
 		value<Width> mask;
 		int priority;
 	};
-	std::vector<write> write_queue;
+
+	class write_buffer {
+		write inline_writes[Ports > 0 ? Ports : 1];
+		size_t inline_count = 0;
+		std::vector<write> spilled_writes; // if not empty, holds all of the queued writes
+
+	public:
+		const write *begin() const {
+			return spilled_writes.empty() ? inline_writes : spilled_writes.data();
+		}
+
+		const write *end() const {
+			return spilled_writes.empty() ? inline_writes + inline_count : spilled_writes.data() + spilled_writes.size();
+		}
+
+		bool empty() const {
+			return begin() == end();
+		}
+
+		// Queues up the write while keeping the queue sorted by priority; writes with equal priority are kept
+		// in the order they were queued.
+		void insert(size_t index, const value<Width> &val, const value<Width> &mask, int priority) {
+			if (inline_count < Ports && spilled_writes.empty()) {
+				size_t position = inline_count++;
+				for (; position > 0 && inline_writes[position - 1].priority > priority; position--)
+					inline_writes[position] = inline_writes[position - 1];
+				write &entry = inline_writes[position];
+				entry.index = index;
+				entry.val = val;
+				entry.mask = mask;
+				entry.priority = priority;
+				return;
+			}
+			if (spilled_writes.empty()) {
+				spilled_writes.assign(inline_writes, inline_writes + inline_count);
+				inline_count = 0;
+			}
+			spilled_writes.insert(
+				std::upper_bound(spilled_writes.begin(), spilled_writes.end(), priority,
+					[](const int a, const write& b) { return a < b.priority; }),
+				write { index, val, mask, priority });
+		}
+
+		void clear() {
+			inline_count = 0;
+			spilled_writes.clear();
+		}
+	};
+	write_buffer write_queue;
 
 	void update(size_t index, const value<Width> &val, const value<Width> &mask, int priority = 0) {
 		assert(index < depth);
-		// Queue up the write while keeping the queue sorted by priority.
-		write_queue.insert(
-			std::upper_bound(write_queue.begin(), write_queue.end(), priority,
-				[](const int a, const write& b) { return a < b.priority; }),
-			write { index, val, mask, priority });
+		write_queue.insert(index, val, mask, priority);
 	}
 
 	// See the note for `wire::commit()`.
@@ -1349,8 +1400,8 @@ struct debug_item : ::cxxrtl_object {
 		attrs   = nullptr;
 	}
 
-	template<size_t Width>
-	debug_item(memory<Width> &item, size_t zero_offset = 0) {
+	template<size_t Width, size_t Ports>
+	debug_item(memory<Width, Ports> &item, size_t zero_offset = 0) {
 		static_assert(Width == 0 || sizeof(item.data[0]) == value<Width>::chunks * sizeof(chunk_t),
 		              "memory<Width> is not compatible with C layout");
 		type    = MEMORY;
@@ -1456,8 +1507,34 @@ struct debug_items {
 	std::map<std::string, std::vector<debug_item>> table;
 	std::map<std::string, std::unique_ptr<debug_attrs>> attrs_table;
 
+	typedef std::map<std::string, std::vector<debug_item>>::iterator iterator;
+	typedef std::map<std::string, std::vector<debug_item>>::const_iterator const_iterator;
+
+private:
+	// Open addressing hash table over the entries of `table`, built by `build_index()`. Its size is a power of two
+	// and it is at most half full, so a lookup of a missing name terminates quickly. The hash of the name is stored
+	// next to the entry so that most entries that do not match are rejected without a string comparison.
+	struct index_slot {
+		size_t hash;
+		std::pair<const std::string, std::vector<debug_item>> *entry;
+	};
+	std::vector<index_slot> hash_index;
+
+	// FNV-1a; `size` is set to the length of the string.
+	static size_t hash_path(const char *path, size_t &size) {
+		uint64_t hash = 0xcbf29ce484222325;
+		const char *ptr = path;
+		for (; *ptr; ptr++)
+			hash = (hash ^ (uint8_t)*ptr) * 0x100000001b3;
+		size = ptr - path;
+		return (size_t)hash;
+	}
+
+public:
 	void add(const std::string &path, debug_item &&item, metadata_map &&item_attrs = {}) {
 		assert((path.empty() || path[path.size() - 1] != ' ') && path.find("  ") == std::string::npos);
+		// The index would not include the new item.
+		hash_index.clear();
 		std::unique_ptr<debug_attrs> &attrs = attrs_table[path];
 		if (attrs.get() == nullptr)
 			attrs = std::unique_ptr<debug_attrs>(new debug_attrs);
@@ -1502,6 +1579,63 @@ struct debug_items {
 	const metadata_map &attrs(const std::string &path) const {
 		return attrs_table.at(path)->map;
 	}
+
+	// Builds a hash index over the items, which makes `find()` take constant time instead of being logarithmic
+	// in the number of items. It should be called once after all items have been added (e.g. after
+	// `module::debug_info()`); adding an item discards the index.
+	void build_index() {
+		size_t capacity = 16;
+		while (capacity < table.size() * 2)
+			capacity *= 2;
+		hash_index.assign(capacity, index_slot { 0, nullptr });
+		for (auto &it : table) {
+			size_t size;
+			size_t hash = hash_path(it.first.c_str(), size);
+			size_t slot = hash & (capacity - 1);
+			while (hash_index[slot].entry != nullptr)
+				slot = (slot + 1) & (capacity - 1);
+			hash_index[slot] = index_slot { hash, &it };
+		}
+	}
+
+	// Returns the parts of the item at `path`, or `nullptr` if there is no such item. Uses the hash index if it
+	// has been built.
+	std::vector<debug_item> *find(const char *path) {
+		if (hash_index.empty()) {
+			auto it = table.find(path);
+			return it == table.end() ? nullptr : &it->second;
+		}
+		size_t size;
+		size_t hash = hash_path(path, size);
+		size_t mask = hash_index.size() - 1;
+		for (size_t slot = hash & mask; hash_index[slot].entry != nullptr; slot = (slot + 1) & mask) {
+			const index_slot &candidate = hash_index[slot];
+			if (candidate.hash == hash && candidate.entry->first.size() == size &&
+					memcmp(candidate.entry->first.data(), path, size) == 0)
+				return &candidate.entry->second;
+		}
+		return nullptr;
+	}
+
+	const std::vector<debug_item> *find(const char *path) const {
+		return const_cast<debug_items *>(this)->find(path);
+	}
+
+	// Returns the range of items that are in the scope `scope` or any of its sub-scopes, i.e. items whose path
+	// starts with `scope` followed by a space; an empty `scope` is the top-level scope, which contains every item.
+	// Since `table` is ordered and a space sorts before any other character that may follow it in a path, these
+	// items are contiguous, and finding them takes two logarithmic lookups rather than a scan over every item.
+	std::pair<iterator, iterator> scope_range(const std::string &scope) {
+		if (scope.empty())
+			return {table.begin(), table.end()};
+		return {table.lower_bound(scope + ' '), table.lower_bound(scope + char(' ' + 1))};
+	}
+
+	std::pair<const_iterator, const_iterator> scope_range(const std::string &scope) const {
+		if (scope.empty())
+			return {table.begin(), table.end()};
+		return {table.lower_bound(scope + ' '), table.lower_bound(scope + char(' ' + 1))};
+	}
 };
 
 // Only `module` scopes are defined. The type is implicit, since Yosys does not currently support
@@ -0,0 +1,127 @@
+/*
+ *  yosys -- Yosys Open SYnthesis Suite
+ *
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#ifndef CXXRTL_PROFILE_H
+#define CXXRTL_PROFILE_H
+
+#include <unordered_map>
+
+#include <cxxrtl/cxxrtl.h>
+
+namespace cxxrtl {
+
+// Measures how many delta cycles `module::step()` takes to converge, and which debug items are responsible for
+// the delta cycles after the first one.
+//
+// A step takes more than one delta cycle when `eval()` reports that the design has not converged and `commit()`
+// then changes some state, such that `eval()` has to run again. The state that changed in such a commit is what
+// kept the loop going; typically it is a signal that is driven by the design and fed back into it through a black
+// box, a clock generated by the design, or (in a harness that steps the design several times per clock edge)
+// a combinational path through the harness. Every extra delta cycle costs as much as a step of a design that
+// converges immediately, so these items are worth restructuring.
+class delta_profiler {
+	std::unordered_map<const chunk_t*, std::string> names;
+	std::vector<uint64_t> histogram_; // histogram_[n] is the number of steps that took n delta cycles
+	std::unordered_map<const chunk_t*, uint64_t> culprit_counts;
+	std::vector<const chunk_t*> changed; // items updated by the last commit
+
+public:
+	// Only the items in `items` that can be updated by `commit()` (wires and memories) can be reported by name.
+	delta_profiler(const debug_items &items) {
+		for (auto &it : items.table)
+			for (auto &part : it.second)
+				if ((part.type == debug_item::WIRE || part.type == debug_item::MEMORY) && part.curr != nullptr)
+					names.emplace(part.curr, it.first);
+	}
+
+	// Same as `module::step()`, but also records the delta cycles that the step took. This function is generic
+	// over ModuleT so that the non-virtual `commit(observer &)` overload of the generated code can be called.
+	template<class ModuleT>
+	size_t step(ModuleT &module, performer *performer = nullptr) {
+		struct : observer {
+			std::vector<const chunk_t*> *changed;
+
+			CXXRTL_ALWAYS_INLINE
+			void on_update(size_t chunks, const chunk_t *base, const chunk_t *value) {
+				changed->push_back(base);
+			}
+
+			CXXRTL_ALWAYS_INLINE
+			void on_update(size_t chunks, const chunk_t *base, const chunk_t *value, size_t index) {
+				changed->push_back(base);
+			}
+		} profile_observer;
+		profile_observer.changed = &changed;
+
+		size_t deltas = 0;
+		bool converged = false;
+		while (true) {
+			converged = module.eval(performer);
+			deltas++;
+			changed.clear();
+			if (!module.commit(profile_observer) || converged)
+				break;
+			// Several rows of a memory may be updated by one commit; count the memory once.
+			std::sort(changed.begin(), changed.end());
+			changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+			for (auto base : changed)
+				culprit_counts[base]++;
+		}
+
+		if (histogram_.size() <= deltas)
+			histogram_.resize(deltas + 1);
+		histogram_[deltas]++;
+		return deltas;
+	}
+
+	// Returns the number of steps that took each number of delta cycles, indexed by the number of delta cycles.
+	const std::vector<uint64_t> &histogram() const {
+		return histogram_;
+	}
+
+	// Returns the number of steps recorded so far.
+	uint64_t steps() const {
+		uint64_t total = 0;
+		for (auto count : histogram_)
+			total += count;
+		return total;
+	}
+
+	// Returns the items whose change caused another delta cycle, with the number of delta cycles each of them
+	// caused, most frequent first. Items that are not in the `debug_items` given to the constructor are
+	// reported as `"<unnamed>"`.
+	std::vector<std::pair<std::string, uint64_t>> culprits() const {
+		std::vector<std::pair<std::string, uint64_t>> result;
+		for (auto &it : culprit_counts) {
+			auto name_it = names.find(it.first);
+			result.emplace_back(name_it != names.end() ? name_it->second : "<unnamed>", it.second);
+		}
+		std::sort(result.begin(), result.end(),
+			[](const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b) {
+				return a.second > b.second || (a.second == b.second && a.first < b.first);
+			});
+		return result;
+	}
+
+	void reset() {
+		histogram_.clear();
+		culprit_counts.clear();
+	}
+};
+
+}
+
+#endif
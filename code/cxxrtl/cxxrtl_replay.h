@@ -26,10 +26,16 @@
 #include <io.h>
 #endif
 
+#if !defined(WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include <fcntl.h>
 #include <cstring>
 #include <cstdio>
 #include <atomic>
+#include <thread>
 #include <unordered_map>
 
 #include <cxxrtl/cxxrtl.h>
@@ -112,6 +118,30 @@
 // exactly the same as the recorded design state. In practice, it is both faster and more reliable (in presence of e.g.
 // user-defined black boxes) to read the recorded values instead of calculating them.
 //
+// Index
+// -----
+//
+// Rewinding requires finding the latest complete sample before the requested sample. Without additional information,
+// finding it requires reading every sample from the beginning of the log, which makes rewinding to the end of a long
+// recording as expensive as replaying all of it. To avoid this, the position of every complete sample is also written
+// to an index file, stored next to the replay log with an `.idx` suffix:
+//
+// <index-file>     ::= <index-header> <index-entry>*
+// <index-header>   ::= 0x52585843 0x????5849
+// <index-entry>    ::= <pointer> <time> <position>
+// <pointer>        ::= 0x????????
+// <time>           ::= 0x???????? 0x???????? 0x????????
+// <position>       ::= 0x???????? 0x????????
+//
+// The player reads the index when it is started and whenever it is asked to rewind, which makes rewinding logarithmic
+// in the number of complete samples. The recorder can be configured to write a complete sample periodically, which
+// bounds the number of incremental samples that have to be read after the complete sample is found. A missing or
+// truncated index is not an error; the player falls back to discovering complete samples while replaying.
+//
+// Since complete samples do not depend on anything that precedes them, the log can be split into windows, each
+// starting at a complete sample and ending right before the next one, and the windows can be read independently of
+// each other. `cxxrtl::replay_windows()` uses this to analyze a recording on several threads at once.
+//
 // Note: The operations described above are conceptual and do not correspond exactly to methods on `cxxrtl::player`.
 // The `cxxrtl::player::replay()` method does not evaluate the design. This is so that delta cycles could be ignored
 // if they are not of interest while replaying.
@@ -157,6 +187,7 @@ public:
 	static constexpr uint16_t VERSION = 0x0400;
 
 	static constexpr uint64_t HEADER_MAGIC = 0x00004c5452585843;
+	static constexpr uint64_t INDEX_MAGIC  = 0x0000584952585843;
 	static constexpr uint64_t VERSION_MASK = 0xffff000000000000;
 
 	static constexpr uint32_t PACKET_DEFINE  = 0xc0000000;
@@ -184,8 +215,11 @@ public:
 
 	class writer {
 		int fd;
+		int index_fd;
 		size_t position;
+		uint64_t flushed;
 		std::vector<uint32_t> buffer;
+		std::vector<uint32_t> index_buffer;
 
 		// These functions aren't overloaded because of implicit numeric conversions.
 
@@ -239,18 +273,24 @@ public:
 		// The buffer size is currently fixed to a "reasonably large" size, determined empirically by measuring writer
 		// performance on a representative design; large but not so large it would e.g. cause address space exhaustion
 		// on 32-bit platforms.
-		writer(spool &spool) : fd(spool.take_write()), position(0), buffer(32 * 1024 * 1024) {
-			assert(fd != -1);
+		writer(spool &spool) : fd(spool.take_write()), index_fd(spool.take_index_write()), position(0), flushed(0),
+		                       buffer(32 * 1024 * 1024) {
+			assert(fd != -1 && index_fd != -1);
 #if !defined(WIN32)
-			int result = ftruncate(fd, 0);
+			int result = ftruncate(fd, 0) | ftruncate(index_fd, 0);
 #else
-			int result = _chsize_s(fd, 0);
+			int result = _chsize_s(fd, 0) | _chsize_s(index_fd, 0);
 #endif
 			assert(result == 0);
+			uint64_t index_magic = ((uint64_t)VERSION << 48) | INDEX_MAGIC;
+			index_buffer.push_back(index_magic >>  0);
+			index_buffer.push_back(index_magic >> 32);
 		}
 
-		writer(writer &&moved) : fd(moved.fd), position(moved.position), buffer(moved.buffer) {
+		writer(writer &&moved) : fd(moved.fd), index_fd(moved.index_fd), position(moved.position),
+		                         flushed(moved.flushed), buffer(moved.buffer), index_buffer(moved.index_buffer) {
 			moved.fd = -1;
+			moved.index_fd = -1;
 			moved.position = 0;
 		}
 
@@ -259,21 +299,36 @@ public:
 
 		// Both write() calls and fwrite() calls are too expensive to perform implicitly. The API consumer must determine
 		// the optimal time to flush the writer and do that explicitly for best performance.
+		//
+		// The index is written after the data it refers to, so that a concurrent reader never finds an index entry
+		// pointing past the end of the log.
 		void flush() {
 			assert(fd != -1);
 			size_t data_size = position * sizeof(uint32_t);
 			size_t data_written = write(fd, buffer.data(), data_size);
 			assert(data_size == data_written);
+			flushed += data_size;
 			position = 0;
+
+			size_t index_size = index_buffer.size() * sizeof(uint32_t);
+			size_t index_written = write(index_fd, index_buffer.data(), index_size);
+			assert(index_size == index_written);
+			index_buffer.clear();
 		}
 
 		~writer() {
 			if (fd != -1) {
 				flush();
 				close(fd);
+				close(index_fd);
 			}
 		}
 
+		// Returns the offset in the log at which the next word will be written.
+		uint64_t offset() const {
+			return flushed + position * sizeof(uint32_t);
+		}
+
 		void write_magic() {
 			// `CXXRTL` followed by version in binary. This header will read backwards on big-endian machines, which allows
 			// detection of this case, both visually and programmatically.
@@ -290,6 +345,15 @@ public:
 		}
 
 		void write_sample(bool incremental, pointer_t pointer, const time &timestamp) {
+			if (!incremental) {
+				const value<time::bits> &raw_timestamp(timestamp);
+				uint64_t sample_offset = offset();
+				index_buffer.insert(index_buffer.end(), {
+					pointer,
+					raw_timestamp.data[0], raw_timestamp.data[1], raw_timestamp.data[2],
+					(uint32_t)(sample_offset >> 0), (uint32_t)(sample_offset >> 32),
+				});
+			}
 			uint32_t flags = (incremental ? sample_flag::INCREMENTAL : 0);
 			emit_word(PACKET_SAMPLE);
 			emit_word(flags);
@@ -333,9 +397,31 @@ public:
 
 	// Reading spools.
 
-	class reader {
+	// Position of a word within a replay log, in bytes.
+	typedef uint64_t pos_t;
+
+	// A source of words for a reader that uses buffered file I/O.
+	class file_source {
 		FILE *f;
 
+	public:
+		// Creates a source, and transfers ownership of `fd`, which must be open for reading.
+		file_source(int fd) : f(fdopen(fd, "r")) {
+			assert(f != nullptr);
+		}
+
+		file_source(file_source &&moved) : f(moved.f) {
+			moved.f = nullptr;
+		}
+
+		file_source(const file_source &) = delete;
+		file_source &operator=(const file_source &) = delete;
+
+		~file_source() {
+			if (f != nullptr)
+				fclose(f);
+		}
+
 		uint32_t absorb_word() {
 			// If we're at end of file, `fread` will not write to `word`, and `PACKET_END` will be returned.
 			uint32_t word = PACKET_END;
@@ -343,6 +429,111 @@ public:
 			return word;
 		}
 
+		pos_t position() {
+			return ftell(f);
+		}
+
+		void rewind(pos_t position) {
+			fseek(f, position, SEEK_SET);
+		}
+	};
+
+#if !defined(WIN32)
+	// A source of words for a reader that decodes the log directly from a memory mapping of the file. This avoids
+	// a library call per word and a copy of every word into a stdio buffer, and lets any number of readers of the same
+	// log share the page cache.
+	//
+	// If the log is being recorded concurrently, the mapping is extended when the reader reaches its end.
+	class mapped_source {
+		int fd;
+		const uint32_t *words = nullptr;
+		size_t mapped_size = 0; // in bytes
+		size_t size = 0; // in words
+		size_t cursor = 0; // in words
+
+		// Returns `true` if the log grew since it was last mapped.
+		bool remap() {
+			struct stat info;
+			if (fstat(fd, &info) != 0 || (size_t)info.st_size / sizeof(uint32_t) <= size)
+				return false;
+			if (words != nullptr)
+				munmap((void *)words, mapped_size);
+			mapped_size = info.st_size;
+			void *mapping = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+			assert(mapping != MAP_FAILED);
+			// Replaying reads the log front to back, so ask the kernel to read ahead aggressively and to drop pages
+			// that have already been decoded.
+			madvise(mapping, mapped_size, MADV_SEQUENTIAL);
+			words = (const uint32_t *)mapping;
+			size = mapped_size / sizeof(uint32_t);
+			return true;
+		}
+
+	public:
+		// Creates a source, and transfers ownership of `fd`, which must be open for reading.
+		mapped_source(int fd) : fd(fd) {
+			assert(fd != -1);
+			remap();
+		}
+
+		mapped_source(mapped_source &&moved) : fd(moved.fd), words(moved.words), mapped_size(moved.mapped_size),
+		                                       size(moved.size), cursor(moved.cursor) {
+			moved.fd = -1;
+			moved.words = nullptr;
+		}
+
+		mapped_source(const mapped_source &) = delete;
+		mapped_source &operator=(const mapped_source &) = delete;
+
+		~mapped_source() {
+			if (words != nullptr)
+				munmap((void *)words, mapped_size);
+			if (fd != -1)
+				close(fd);
+		}
+
+		uint32_t absorb_word() {
+			// Like `file_source`, return `PACKET_END` without advancing if we're at end of file.
+			if (cursor == size && !remap())
+				return PACKET_END;
+			return words[cursor++];
+		}
+
+		pos_t position() {
+			return cursor * sizeof(uint32_t);
+		}
+
+		void rewind(pos_t position) {
+			static constexpr size_t PREFETCH_SIZE = 1 << 20;
+
+			assert(position % sizeof(uint32_t) == 0);
+			size_t distance = std::max(position, cursor * sizeof(uint32_t)) -
+			                  std::min(position, cursor * sizeof(uint32_t));
+			cursor = position / sizeof(uint32_t);
+			// A seek is followed by a straight replay from the new position, so prefetch the start of it. Short jumps
+			// (like the ones used to peek at the next sample) stay within pages that are already being read ahead.
+			if (distance > PREFETCH_SIZE && cursor < size) {
+				size_t page_size = sysconf(_SC_PAGESIZE);
+				size_t begin = position & ~(page_size - 1);
+				size_t end = std::min(mapped_size, begin + PREFETCH_SIZE);
+				madvise((char *)words + begin, end - begin, MADV_WILLNEED);
+			}
+		}
+	};
+#endif
+
+	// A reader decodes the log from words provided by `SourceT`.
+	template<class SourceT>
+	class basic_reader {
+		SourceT source;
+		int index_fd;
+		uint64_t index_offset = 0;
+
+		CXXRTL_ALWAYS_INLINE
+		uint32_t absorb_word() {
+			return source.absorb_word();
+		}
+
 		uint64_t absorb_dword() {
 			uint32_t lo = absorb_word();
 			uint32_t hi = absorb_word();
@@ -384,31 +575,81 @@ public:
 		}
 
 	public:
-		typedef uint64_t pos_t;
+		typedef spool::pos_t pos_t;
 
-		// Creates a reader, and transfers ownership of `fd`, which must be open for reading.
-		reader(spool &spool) : f(fdopen(spool.take_read(), "r")) {
-			assert(f != nullptr);
+		// Creates a reader, and acquires the read file descriptors of `spool`.
+		basic_reader(spool &spool) : source(spool.take_read()), index_fd(spool.take_index_read()) {
+			assert(index_fd != -1);
 		}
 
-		reader(reader &&moved) : f(moved.f) {
-			moved.f = nullptr;
+		basic_reader(basic_reader &&moved) : source(std::move(moved.source)), index_fd(moved.index_fd),
+		                                     index_offset(moved.index_offset) {
+			moved.index_fd = -1;
 		}
 
-		reader(const reader &) = delete;
-		reader &operator=(const reader &) = delete;
+		basic_reader(const basic_reader &) = delete;
+		basic_reader &operator=(const basic_reader &) = delete;
 
-		~reader() {
-			if (f != nullptr)
-				fclose(f);
+		~basic_reader() {
+			if (index_fd != -1)
+				close(index_fd);
+		}
+
+		struct index_entry {
+			pointer_t pointer;
+			time timestamp;
+			pos_t position;
+		};
+
+		// Reads the index entries written since the previous call. Entries that have only been partially written
+		// (if the log is being recorded concurrently) are left to be read by the next call.
+		void read_index(std::vector<index_entry> &entries) {
+			static constexpr size_t ENTRY_WORDS = 6;
+
+			std::vector<uint32_t> words;
+			lseek(index_fd, index_offset, SEEK_SET);
+			while (true) {
+				size_t end = words.size();
+				words.resize(end + 4096);
+				auto bytes_read = read(index_fd, &words[end], 4096 * sizeof(uint32_t));
+				if (bytes_read <= 0) {
+					words.resize(end);
+					break;
+				}
+				words.resize(end + bytes_read / sizeof(uint32_t));
+				if (bytes_read % sizeof(uint32_t) != 0)
+					break;
+			}
+
+			size_t index = 0;
+			if (index_offset == 0) {
+				if (words.size() < 2)
+					return;
+				uint64_t magic = ((uint64_t)words[1] << 32) | words[0];
+				assert((magic & ~VERSION_MASK) == INDEX_MAGIC);
+				assert((magic >> 48) == VERSION);
+				index = 2;
+			}
+			for (; index + ENTRY_WORDS <= words.size(); index += ENTRY_WORDS) {
+				value<time::bits> raw_timestamp;
+				raw_timestamp.data[0] = words[index + 1];
+				raw_timestamp.data[1] = words[index + 2];
+				raw_timestamp.data[2] = words[index + 3];
+				entries.push_back(index_entry {
+					words[index + 0],
+					time(raw_timestamp),
+					((pos_t)words[index + 5] << 32) | words[index + 4],
+				});
+			}
+			index_offset += index * sizeof(uint32_t);
 		}
 
 		pos_t position() {
-			return ftell(f);
+			return source.position();
 		}
 
 		void rewind(pos_t position) {
-			fseek(f, position, SEEK_SET);
+			source.rewind(position);
 		}
 
 		void read_magic() {
@@ -491,6 +732,11 @@ public:
 		}
 	};
 
+	typedef basic_reader<file_source> reader;
+#if !defined(WIN32)
+	typedef basic_reader<mapped_source> mapped_reader;
+#endif
+
 	// Opening spools. For certain uses of the record/replay mechanism, two distinct open files (two open files, i.e.
 	// two distinct file pointers, and not just file descriptors, which share the file pointer if duplicated) are used,
 	// for a reader and writer thread. This class manages the lifetime of the descriptors for these files. When only
@@ -498,15 +744,22 @@ public:
 private:
 	std::atomic<int> writefd;
 	std::atomic<int> readfd;
+	std::atomic<int> index_writefd;
+	std::atomic<int> index_readfd;
 
 public:
 	spool(const std::string &filename)
 		: writefd(open(filename.c_str(), O_CREAT|O_BINARY|O_WRONLY|O_APPEND, 0644)),
-		  readfd(open(filename.c_str(), O_BINARY|O_RDONLY)) {
+		  readfd(open(filename.c_str(), O_BINARY|O_RDONLY)),
+		  index_writefd(open((filename + ".idx").c_str(), O_CREAT|O_BINARY|O_WRONLY|O_APPEND, 0644)),
+		  index_readfd(open((filename + ".idx").c_str(), O_BINARY|O_RDONLY)) {
 		assert(writefd.load() != -1 && readfd.load() != -1);
+		assert(index_writefd.load() != -1 && index_readfd.load() != -1);
 	}
 
-	spool(spool &&moved) : writefd(moved.writefd.exchange(-1)), readfd(moved.readfd.exchange(-1)) {}
+	spool(spool &&moved) : writefd(moved.writefd.exchange(-1)), readfd(moved.readfd.exchange(-1)),
+	                       index_writefd(moved.index_writefd.exchange(-1)),
+	                       index_readfd(moved.index_readfd.exchange(-1)) {}
 
 	spool(const spool &) = delete;
 	spool &operator=(const spool &) = delete;
@@ -517,6 +770,10 @@ public:
 			close(fd);
 		if ((fd = readfd.exchange(-1)) != -1)
 			close(fd);
+		if ((fd = index_writefd.exchange(-1)) != -1)
+			close(fd);
+		if ((fd = index_readfd.exchange(-1)) != -1)
+			close(fd);
 	}
 
 	// Atomically acquire a write file descriptor for the spool. Can be called once, and will return -1 the next time
@@ -530,6 +787,15 @@ public:
 	int take_read() {
 		return readfd.exchange(-1);
 	}
+
+	// Same as `take_write()` and `take_read()`, for the index file.
+	int take_index_write() {
+		return index_writefd.exchange(-1);
+	}
+
+	int take_index_read() {
+		return index_readfd.exchange(-1);
+	}
 };
 
 // A CXXRTL recorder samples design state, producing complete or incremental updates, and writes them to a spool.
@@ -549,11 +815,24 @@ class recorder {
 	bool streaming = false; // whether variable definitions have been written
 	spool::pointer_t pointer = 0;
 	time timestamp;
+	size_t complete_interval = 0; // 0 if complete samples are only written explicitly
+	size_t incremental_count = 0; // number of incremental samples since the last complete sample
 
 public:
 	template<typename ...Args>
 	recorder(Args &&...args) : writer(std::forward<Args>(args)...) {}
 
+	// Write a complete sample after every `interval` incremental samples. Rewinding has to read at most `interval`
+	// incremental samples after finding a complete sample in the index, at the cost of the space taken by the complete
+	// samples.
+	//
+	// The complete sample is written right after the incremental sample that completes the interval, with the same
+	// timestamp, so it holds exactly the state that incremental sample produced; in particular, the inputs it records
+	// are not affected by inputs being changed before the next call to `advance_time()`.
+	void record_complete_every(size_t interval) {
+		complete_interval = interval;
+	}
+
 	void start(module &module, std::string top_path = "") {
 		debug_items items;
 		module.debug_info(&items, /*scopes=*/nullptr, top_path);
@@ -602,6 +881,7 @@ public:
 	void record_complete() {
 		assert(streaming);
 
+		incremental_count = 0;
 		writer.write_sample(/*incremental=*/false, pointer++, timestamp);
 		for (auto var : variables) {
 			assert(var.ident != 0);
@@ -644,6 +924,9 @@ public:
 		}
 		bool changed = module.commit(record_observer);
 		writer.write_end();
+
+		if (complete_interval != 0 && ++incremental_count == complete_interval)
+			record_complete();
 		return changed;
 	}
 
@@ -667,22 +950,37 @@ public:
 // A CXXRTL player reads samples from a spool, and changes the design state accordingly. To start reading samples,
 // a spool must have been initialized: the recorder must have been started and an initial complete sample must have
 // been written.
-class player {
+//
+// The player is generic over the spool reader; `player` reads the log through buffered file I/O, and `mapped_player`
+// reads it through a memory mapping, which is faster for long straight replays.
+template<class ReaderT>
+class basic_player {
 	struct variable {
 		size_t chunks;
 		size_t depth; /* == 1 for wires */
 		chunk_t *curr;
 	};
 
-	spool::reader reader;
+	ReaderT reader;
 	std::unordered_map<spool::ident_t, variable> variables;
 	bool streaming = false; // whether variable definitions have been read
 	bool initialized = false; // whether a sample has ever been read
 	spool::pointer_t pointer = 0;
 	time timestamp;
 
-	std::map<spool::pointer_t, spool::reader::pos_t, std::greater<spool::pointer_t>> index_by_pointer;
-	std::map<time, spool::reader::pos_t, std::greater<time>> index_by_timestamp;
+	std::map<spool::pointer_t, spool::pos_t, std::greater<spool::pointer_t>> index_by_pointer;
+	std::map<time, spool::pos_t, std::greater<time>> index_by_timestamp;
+
+	// Adds the complete samples that have been written to the index since it was last read. Several complete
+	// samples may share a timestamp; the first of them is the one that is found by time.
+	void update_index() {
+		std::vector<typename ReaderT::index_entry> entries;
+		reader.read_index(entries);
+		for (auto &entry : entries) {
+			index_by_pointer.emplace(entry.pointer, entry.position);
+			index_by_timestamp.emplace(entry.timestamp, entry.position);
+		}
+	}
 
 	bool peek_sample(spool::pointer_t &pointer, time &timestamp) {
 		bool incremental;
@@ -694,7 +992,7 @@ class player {
 
 public:
 	template<typename ...Args>
-	player(Args &&...args) : reader(std::forward<Args>(args)...) {}
+	basic_player(Args &&...args) : reader(std::forward<Args>(args)...) {}
 
 	// The `top_path` must match the one given to the recorder.
 	void start(module &module, std::string top_path = "") {
@@ -730,6 +1028,7 @@ public:
 		}
 		assert(variables.size() > 0);
 		streaming = true;
+		update_index();
 
 		// Establish the initial state of the design.
 		std::vector<diagnostic> diagnostics;
@@ -737,6 +1036,17 @@ public:
 		assert(initialized && diagnostics.empty());
 	}
 
+	// Returns the pointers of the complete samples known so far, in ascending order. Each of them can be passed to
+	// `rewind_to()` without reading any preceding incremental samples.
+	std::vector<spool::pointer_t> checkpoints() {
+		assert(streaming);
+		update_index();
+		std::vector<spool::pointer_t> pointers;
+		for (auto it = index_by_pointer.rbegin(); it != index_by_pointer.rend(); ++it)
+			pointers.push_back(it->first);
+		return pointers;
+	}
+
 	// Returns the pointer of the current sample.
 	spool::pointer_t current_pointer() {
 		assert(initialized);
@@ -772,6 +1082,7 @@ public:
 
 		// The pointers in the replay log start from one that is greater than `at_pointer`. In this case the pointer will
 		// never be reached.
+		update_index();
 		assert(index_by_pointer.size() > 0);
 		if (at_pointer < index_by_pointer.rbegin()->first)
 			return false;
@@ -802,6 +1113,7 @@ public:
 
 		// The timestamps in the replay log start from one that is greater than `at_or_before_timestamp`. In this case
 		// the timestamp will never be reached. Otherwise, this function will always succeed.
+		update_index();
 		assert(index_by_timestamp.size() > 0);
 		if (at_or_before_timestamp < index_by_timestamp.rbegin()->first)
 			return false;
@@ -843,13 +1155,13 @@ public:
 		// The very first sample that is read must be a complete sample. This is required for the rewind functions to work.
 		assert(initialized || !incremental);
 
-		// It is possible (though not very useful) to have several complete samples with the same timestamp in a row.
-		// Ensure that we associate the timestamp with the position of the first such complete sample. (This condition
-		// works because the player never jumps over a sample.)
-		if (!incremental && !index_by_pointer.count(pointer)) {
-			assert(!index_by_timestamp.count(timestamp));
-			index_by_pointer[pointer] = position;
-			index_by_timestamp[timestamp] = position;
+		// It is possible to have several complete samples with the same timestamp (e.g. if the recorder inserts one
+		// periodically). Ensure that we associate the timestamp with the position of the first such complete sample.
+		// (This works because complete samples are added to the index in order, either from the index file or because
+		// the player never jumps over a sample.)
+		if (!incremental) {
+			index_by_pointer.emplace(pointer, position);
+			index_by_timestamp.emplace(timestamp, position);
 		}
 
 		uint32_t header;
@@ -868,6 +1180,82 @@ public:
 	}
 };
 
+typedef basic_player<spool::reader> player;
+#if !defined(WIN32)
+typedef basic_player<spool::mapped_reader> mapped_player;
+#endif
+
+// Replays every sample of the replay log in `filename` once, splitting the log into windows that start at complete
+// samples and replaying the windows on up to `threads` threads. Each thread opens its own spool and instantiates its
+// own `ModuleT`, so the module must be default constructible and must not share mutable state between instances.
+//
+// For every window, a result is initialized as a copy of `initial`, and `visit(result, items, player)` is called for
+// every sample in the window (in order), with `items` being the debug items of the module the window is replayed into.
+// The results of all windows are then combined in the order of the windows by calling `reduce(accumulator, result)`,
+// with the accumulator also starting as a copy of `initial`, and the accumulator is returned.
+//
+// Like `player::replay()`, this function does not evaluate the design; if values of debug items that are not design
+// state are of interest, `visit` has to evaluate the module. Since a complete sample written by `recorder` holds the
+// same values as the sample preceding it, a visitor that compares consecutive samples (e.g. to count toggles) can
+// treat the first sample of each window as having no changes without missing any of them.
+template<class ModuleT, class PlayerT = player, class ResultT, class VisitT, class ReduceT>
+ResultT replay_windows(const std::string &filename, size_t threads, const ResultT &initial, VisitT visit,
+                       ReduceT reduce, std::string top_path = "") {
+	struct context {
+		spool spool_;
+		PlayerT player;
+		ModuleT module;
+		debug_items items;
+
+		context(const std::string &filename, const std::string &top_path) : spool_(filename), player(spool_) {
+			module.debug_info(&items, /*scopes=*/nullptr, top_path);
+			player.start(items);
+		}
+	};
+
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::unique_ptr<context> first(new context(filename, top_path));
+	std::vector<spool::pointer_t> windows = first->player.checkpoints();
+	assert(!windows.empty());
+	threads = std::min(threads, windows.size());
+
+	std::vector<ResultT> results(windows.size(), initial);
+	std::atomic<size_t> next_window(0);
+	auto run = [&](context &ctx) {
+		size_t window;
+		while ((window = next_window.fetch_add(1)) < windows.size()) {
+			bool found = ctx.player.rewind_to(windows[window], nullptr);
+			assert(found);
+			(void)found;
+			visit(results[window], (const debug_items &)ctx.items, ctx.player);
+
+			spool::pointer_t next_pointer;
+			while (ctx.player.get_next_pointer(next_pointer) &&
+					(window + 1 == windows.size() || next_pointer < windows[window + 1])) {
+				ctx.player.replay(nullptr);
+				visit(results[window], (const debug_items &)ctx.items, ctx.player);
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t index = 1; index < threads; index++)
+		workers.emplace_back([&] {
+			std::unique_ptr<context> ctx(new context(filename, top_path));
+			run(*ctx);
+		});
+	run(*first);
+	for (auto &worker : workers)
+		worker.join();
+
+	ResultT accumulator = initial;
+	for (auto &result : results)
+		reduce(accumulator, result);
+	return accumulator;
+}
+
 }
 
 #endif
@@ -19,6 +19,10 @@
 #ifndef CXXRTL_VCD_H
 #define CXXRTL_VCD_H
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 #include <cxxrtl/cxxrtl.h>
 
 namespace cxxrtl {
@@ -40,6 +44,26 @@ class vcd_writer {
 	std::map<chunk_t*, size_t> aliases;
 	bool streaming = false;
 
+	// In the parallel mode, the variables are split into contiguous partitions, and every partition is encoded
+	// into its own section by a worker thread. The sections are appended to `buffer` in partition order, so that
+	// the output is byte for byte identical to the output of the serial mode.
+	struct section {
+		size_t begin;
+		size_t end;
+		std::string buffer;
+	};
+
+	size_t thread_count = 1;
+	std::vector<section> sections;
+	std::vector<std::thread> workers;
+	std::mutex workers_mutex;
+	std::condition_variable workers_start;
+	std::condition_variable workers_done;
+	uint64_t generation = 0;
+	size_t pending = 0;
+	bool first_sample_pending = false;
+	bool stopping = false;
+
 	void emit_timescale(unsigned number, const std::string &unit) {
 		assert(!streaming);
 		assert(number == 1 || number == 10 || number == 100);
@@ -66,9 +90,9 @@ class vcd_writer {
 		}
 	}
 
-	void emit_ident(size_t ident) {
+	static void emit_ident(std::string &output, size_t ident) {
 		do {
-			buffer += '!' + ident % 94; // "base94"
+			output += '!' + ident % 94; // "base94"
 			ident /= 94;
 		} while (ident != 0);
 	}
@@ -89,7 +113,7 @@ class vcd_writer {
 	              size_t lsb_at, bool multipart) {
 		assert(!streaming);
 		buffer += "$var " + type + " " + std::to_string(var.width) + " ";
-		emit_ident(var.ident);
+		emit_ident(buffer, var.ident);
 		buffer += " ";
 		emit_name(name);
 		if (multipart || name.back() == ']' || lsb_at != 0) {
@@ -112,26 +136,38 @@ class vcd_writer {
 		buffer += "#" + std::to_string(timestamp) + "\n";
 	}
 
-	void emit_scalar(const variable &var) {
+	void emit_scalar(std::string &output, const variable &var) {
 		assert(streaming);
 		assert(var.width == 1);
-		buffer += (*var.curr ? '1' : '0');
-		emit_ident(var.ident);
-		buffer += '\n';
+		output += (*var.curr ? '1' : '0');
+		emit_ident(output, var.ident);
+		output += '\n';
 	}
 
-	void emit_vector(const variable &var) {
+	void emit_vector(std::string &output, const variable &var) {
 		assert(streaming);
-		buffer += 'b';
+		output += 'b';
 		for (size_t bit = var.width - 1; bit != (size_t)-1; bit--) {
 			bool bit_curr = var.curr[bit / (8 * sizeof(chunk_t))] & (1 << (bit % (8 * sizeof(chunk_t))));
-			buffer += (bit_curr ? '1' : '0');
+			output += (bit_curr ? '1' : '0');
 		}
 		if (var.width == 0)
-			buffer += '0';
-		buffer += ' ';
-		emit_ident(var.ident);
-		buffer += '\n';
+			output += '0';
+		output += ' ';
+		emit_ident(output, var.ident);
+		output += '\n';
+	}
+
+	void emit_changes(std::string &output, size_t begin, size_t end, bool first_sample) {
+		for (size_t index = begin; index < end; index++) {
+			const variable &var = variables[index];
+			if (test_variable(var) || first_sample) {
+				if (var.width == 1)
+					emit_scalar(output, var);
+				else
+					emit_vector(output, var);
+			}
+		}
 	}
 
 	void reset_outlines() {
@@ -172,6 +208,79 @@ class vcd_writer {
 		}
 	}
 
+	// Splits the variables into partitions of approximately equal total width, since the time spent encoding
+	// a variable is roughly proportional to its width, and starts a worker thread for every partition except
+	// the first one, which is encoded by the thread calling `sample()`.
+	void start_workers() {
+		size_t total_width = 0;
+		for (auto &var : variables)
+			total_width += var.width + 1;
+		size_t partition_count = std::min(thread_count, variables.size());
+		size_t partition_width = total_width / std::max<size_t>(partition_count, 1) + 1;
+
+		size_t begin = 0, width = 0;
+		for (size_t index = 0; index < variables.size(); index++) {
+			width += variables[index].width + 1;
+			if (width >= partition_width || index + 1 == variables.size()) {
+				sections.push_back(section { begin, index + 1, {} });
+				begin = index + 1;
+				width = 0;
+			}
+		}
+
+		for (size_t index = 1; index < sections.size(); index++)
+			workers.emplace_back([this, index] { run_worker(index); });
+	}
+
+	void run_worker(size_t index) {
+		uint64_t seen_generation = 0;
+		while (true) {
+			bool first_sample;
+			{
+				std::unique_lock<std::mutex> lock(workers_mutex);
+				workers_start.wait(lock, [&] { return stopping || generation != seen_generation; });
+				if (stopping)
+					return;
+				seen_generation = generation;
+				first_sample = first_sample_pending;
+			}
+			section &sect = sections[index];
+			emit_changes(sect.buffer, sect.begin, sect.end, first_sample);
+			{
+				std::lock_guard<std::mutex> lock(workers_mutex);
+				if (--pending == 0)
+					workers_done.notify_one();
+			}
+		}
+	}
+
+	void sample_parallel(bool first_sample) {
+		// Outlines are shared between partitions, so they are evaluated up front rather than lazily
+		// by `test_variable()`.
+		for (auto &outline_it : outlines)
+			if (!outline_it.second) {
+				outline_it.first->eval();
+				outline_it.second = true;
+			}
+
+		{
+			std::lock_guard<std::mutex> lock(workers_mutex);
+			first_sample_pending = first_sample;
+			pending = workers.size();
+			generation++;
+		}
+		workers_start.notify_all();
+
+		emit_changes(buffer, sections[0].begin, sections[0].end, first_sample);
+
+		std::unique_lock<std::mutex> lock(workers_mutex);
+		workers_done.wait(lock, [&] { return pending == 0; });
+		for (size_t index = 1; index < sections.size(); index++) {
+			buffer += sections[index].buffer;
+			sections[index].buffer.clear();
+		}
+	}
+
 	static std::vector<std::string> split_hierarchy(const std::string &hier_name) {
 		std::vector<std::string> hierarchy;
 		size_t prev = 0;
@@ -191,10 +300,37 @@ class vcd_writer {
 public:
 	std::string buffer;
 
+	vcd_writer() = default;
+
+	// The worker threads refer to the writer, so it cannot be copied or moved.
+	vcd_writer(const vcd_writer &) = delete;
+	vcd_writer &operator=(const vcd_writer &) = delete;
+
+	~vcd_writer() {
+		{
+			std::lock_guard<std::mutex> lock(workers_mutex);
+			stopping = true;
+		}
+		workers_start.notify_all();
+		for (auto &worker : workers)
+			worker.join();
+	}
+
 	void timescale(unsigned number, const std::string &unit) {
 		emit_timescale(number, unit);
 	}
 
+	// Encode samples using `count` threads (including the one calling `sample()`). Handing every sample off to
+	// the workers has a fixed cost of a few microseconds, so this only pays off for designs with many thousands
+	// of variables, such as the whole SoC.
+	//
+	// Threads can only be configured before the first call to `sample()`.
+	void threads(size_t count) {
+		assert(!streaming);
+		assert(count > 0);
+		thread_count = count;
+	}
+
 	void add(const std::string &hier_name, const debug_item &item, bool multipart = false) {
 		std::vector<std::string> scope = split_hierarchy(hier_name);
 		std::string name = scope.back();
@@ -266,13 +402,12 @@ public:
 		}
 		reset_outlines();
 		emit_time(timestamp);
-		for (auto var : variables)
-			if (test_variable(var) || first_sample) {
-				if (var.width == 1)
-					emit_scalar(var);
-				else
-					emit_vector(var);
-			}
+		if (first_sample && thread_count > 1)
+			start_workers();
+		if (sections.size() > 1)
+			sample_parallel(first_sample);
+		else
+			emit_changes(buffer, 0, variables.size(), first_sample);
 	}
 };
 
@@ -1,23 +1,226 @@
 #include <cxxrtl/cxxrtl.h>
 #include <cxxrtl/cxxrtl_vcd.h>
+#include <cxxrtl/cxxrtl_replay.h>
+#include <cxxrtl/cxxrtl_profile.h>
 #include <fstream>
+#include <iostream>
+#include <string>
 
 #include "base/prelude.h"
 #include "base/buffer.h"
 #include "base/arena.h"
 #include "base/extra.h"
+#include "cosim.h"
 #include "../output/Cpu.hpp"
 
 using cxxrtl_design::p_Cpu;
 
 static const char* help_message =
-    "Usage: simulator FIRMWARE_PATH\n"
+    "Usage: simulator FIRMWARE_PATH [--debug | --profile-deltas] [--cosim NAME]\n"
     "\n"
     "       Runs the machine code at FIRMWARE_PATH and prints the\n"
     "       CPU state after 1000 cycles.\n"
     "\n"
+    "       --debug  Records the run and then reads debugger commands\n"
+    "                from standard input, one per line:\n"
+    "\n"
+    "                step [N]          Moves N cycles forward.\n"
+    "                back [N]          Moves N cycles backward.\n"
+    "                until-pc X        Moves forward until pc == X.\n"
+    "                back-until-pc X   Moves backward until pc == X.\n"
+    "                cycle N           Moves to cycle N.\n"
+    "                registers         Prints the CPU state.\n"
+    "                quit\n"
+    "\n"
+    "       --profile-deltas\n"
+    "                Prints how many delta cycles each step took, and\n"
+    "                which wires caused the delta cycles after the\n"
+    "                first one.\n"
+    "\n"
+    "       --cosim NAME\n"
+    "                Forwards bus accesses to 0xFFFF0000-0xFFFFFFFF to a\n"
+    "                driver process through the shared memory object\n"
+    "                /NAME, and waits for the driver to attach first.\n"
+    "                See code/cosim.h for the protocol.\n"
+    "\n"
     "       --help   Prints this message.\n";
 
+static const I64 cycle_count = 1000;
+
+static const char* spool_path = "output/simulator.spool";
+
+static const U32 mmio_base = 0xFFFF0000;
+static const U32 mmio_size = 0x00010000;
+
+static void print_registers(Buffer* console, p_Cpu& cpu) {
+    for (I64 i = 0; i < 32; i++) {
+        U8    storage[20] = {};
+        Bytes i_bytes     = i64_to_string(i, 10, storage);
+        i_bytes           = prepend(i_bytes, "x");
+        i_bytes           = left_pad(i_bytes, ' ', 4);
+        I64   value       = cpu.memory_p_registers[i].get<U32>();
+        print(console, "%s = 0x%x\n", i_bytes, value);
+    }
+}
+
+static void print_delta_profile(Buffer* console, cxxrtl::delta_profiler* profiler) {
+    const std::vector<uint64_t>& histogram = profiler->histogram();
+    I64                          steps     = profiler->steps();
+
+    print(console, "Delta cycles per step:\n");
+    for (I64 deltas = 0; deltas < (I64) histogram.size(); deltas++) {
+        if (histogram[deltas] > 0) {
+            I64 permille = histogram[deltas] * 1000 / steps;
+            print(console, "%i: %i steps (%i.%i%)\n", deltas, (I64) histogram[deltas], permille / 10, permille % 10);
+        }
+    }
+
+    auto culprits = profiler->culprits();
+    if (culprits.empty()) {
+        print(console, "No step took more than one delta cycle.\n");
+        return;
+    }
+    print(console, "Extra delta cycles caused by:\n");
+    for (auto& culprit : culprits) {
+        print(console, "%i  %s\n", (I64) culprit.second, make_bytes(culprit.first.c_str()));
+    }
+}
+
+// Same as `cpu.step()`, but records every delta cycle if `recorder` is not NULL,
+// and counts them if `profiler` is not NULL.
+static void step(p_Cpu& cpu, cxxrtl::recorder* recorder, cxxrtl::delta_profiler* profiler) {
+    if (profiler != NULL) {
+        profiler->step(cpu);
+        return;
+    }
+    if (recorder == NULL) {
+        cpu.step();
+        return;
+    }
+
+    bool converged = false;
+    do {
+        converged = cpu.eval();
+    } while (recorder->record_incremental(cpu) && !converged);
+}
+
+// The debugger moves through the recording of the run instead of simulating
+// it again. `cycle_pointers[i]` is the last sample of cycle `i - 1`, with
+// `cycle_pointers[0]` being the state before the first cycle, so moving to any
+// cycle is a `rewind_to()`, which reads at most one checkpoint interval of
+// samples and does not evaluate the design.
+struct Debugger {
+    cxxrtl::spool                         spool;
+    cxxrtl::mapped_player                 player;
+    p_Cpu                                 replica;
+    std::vector<cxxrtl::spool::pointer_t> cycle_pointers;
+    I64                                   cycle;
+
+    Debugger(const char* path) : spool(path), player(spool), cycle(0) {}
+};
+
+static void start_debugger(Debugger* debugger) {
+    cxxrtl::mapped_player& player = debugger->player;
+    player.start(debugger->replica);
+
+    // The player is at the initial complete sample. Every other cycle ends
+    // where the timestamp of the next sample changes.
+    cxxrtl::time timestamp;
+    while (true) {
+        if (!player.get_next_time(timestamp) || timestamp != player.current_time()) {
+            debugger->cycle_pointers.push_back(player.current_pointer());
+        }
+        if (!player.replay(NULL)) {
+            break;
+        }
+    }
+
+    debugger->cycle = debugger->cycle_pointers.size() - 1;
+}
+
+static void move_to_cycle(Debugger* debugger, I64 cycle) {
+    I64 last_cycle  = debugger->cycle_pointers.size() - 1;
+    cycle           = cycle < 0 ? 0 : cycle > last_cycle ? last_cycle : cycle;
+    debugger->cycle = cycle;
+
+    bool found = debugger->player.rewind_to(debugger->cycle_pointers[cycle], NULL);
+    assert(found);
+}
+
+static U32 get_pc(Debugger* debugger) {
+    return debugger->replica.p_pc.curr.get<U32>();
+}
+
+// Moves one cycle at a time in `direction` until pc == `pc`, and stays where it
+// was if it never is.
+static bool search_pc(Debugger* debugger, I64 direction, U32 pc) {
+    I64 start_cycle = debugger->cycle;
+    I64 last_cycle  = debugger->cycle_pointers.size() - 1;
+    for (I64 cycle = start_cycle + direction; 0 <= cycle && cycle <= last_cycle; cycle += direction) {
+        move_to_cycle(debugger, cycle);
+        if (get_pc(debugger) == pc) {
+            return true;
+        }
+    }
+    move_to_cycle(debugger, start_cycle);
+    return false;
+}
+
+static void run_debugger(Buffer* console, Debugger* debugger) {
+    start_debugger(debugger);
+    print(console, INFO "Recorded %i cycles. Type \"quit\" to exit.\n", debugger->cycle);
+    print(console, "cycle %i pc = 0x%x\n", debugger->cycle, (I64) get_pc(debugger));
+    flush(console);
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        char command[32] = {};
+        char argument[32] = {};
+        I32  fields       = sscanf(line.c_str(), "%31s %31s", command, argument);
+        if (fields < 1) {
+            continue;
+        }
+
+        I64 count = 1;
+        if (fields == 2) {
+            char* end = NULL;
+            count     = strtoll(argument, &end, 0);
+            if (*end != 0) {
+                print(console, ERROR "Invalid number \"%s\".\n", make_bytes(argument));
+                flush(console);
+                continue;
+            }
+        }
+
+        bool moved = true;
+        if (strcmp(command, "step") == 0 || strcmp(command, "s") == 0) {
+            move_to_cycle(debugger, debugger->cycle + count);
+        } else if (strcmp(command, "back") == 0 || strcmp(command, "b") == 0) {
+            move_to_cycle(debugger, debugger->cycle - count);
+        } else if (strcmp(command, "cycle") == 0 && fields == 2) {
+            move_to_cycle(debugger, count);
+        } else if ((strcmp(command, "until-pc") == 0 || strcmp(command, "back-until-pc") == 0) && fields == 2) {
+            I64         direction = command[0] == 'b' ? -1 : 1;
+            const char* where     = direction < 0 ? "before" : "after";
+            if (!search_pc(debugger, direction, count)) {
+                print(console, WARN "pc is never 0x%x %s this cycle.\n", count, make_bytes(where));
+            }
+        } else if (strcmp(command, "registers") == 0 || strcmp(command, "r") == 0) {
+            print_registers(console, debugger->replica);
+        } else if (strcmp(command, "quit") == 0 || strcmp(command, "q") == 0) {
+            break;
+        } else {
+            print(console, ERROR "Unknown command \"%s\".\n", make_bytes(line.c_str()));
+            moved = false;
+        }
+
+        if (moved) {
+            print(console, "cycle %i pc = 0x%x\n", debugger->cycle, (I64) get_pc(debugger));
+        }
+        flush(console);
+    }
+}
+
 int main(int argc, char** argv) {
     Buffer console = make_console();
 
@@ -31,6 +234,26 @@ int main(int argc, char** argv) {
     char* firmware_path       = argv[1];
     Bytes firmware_path_bytes = make_bytes(firmware_path);
 
+    bool  debug          = false;
+    bool  profile_deltas = false;
+    char* cosim_name     = NULL;
+    for (I64 i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--debug") == 0) {
+            debug = true;
+        } else if (strcmp(argv[i], "--profile-deltas") == 0) {
+            profile_deltas = true;
+        } else if (strcmp(argv[i], "--cosim") == 0 && i + 1 < argc) {
+            cosim_name = argv[++i];
+        } else {
+            print(&console, ERROR "Unknown option \"%s\".\n", make_bytes(argv[i]));
+            flush_and_exit(&console, EXIT_FAILURE);
+        }
+    }
+    if (debug && profile_deltas) {
+        print(&console, ERROR "--debug and --profile-deltas cannot be used together.\n");
+        flush_and_exit(&console, EXIT_FAILURE);
+    }
+
     I32 input_fd = open(firmware_path, O_RDONLY);
     if (input_fd == -1) {
         print(&console, ERROR "Failed to open \"%s\": %s.\n", firmware_path_bytes, get_error());
@@ -63,31 +286,80 @@ int main(int argc, char** argv) {
 
     std::ofstream waves("output/waves.vcd");
 
+    // The spool is opened for appending, so a previous recording has to be
+    // removed first.
+    cxxrtl::spool*    spool    = NULL;
+    cxxrtl::recorder* recorder = NULL;
+    if (debug) {
+        unlink(spool_path);
+        unlink((std::string(spool_path) + ".idx").c_str());
+
+        spool    = new cxxrtl::spool(spool_path);
+        recorder = new cxxrtl::recorder(*spool);
+        recorder->record_complete_every(64);
+        recorder->start(cpu);
+        recorder->record_complete();
+    }
+
+    cxxrtl::delta_profiler* profiler = NULL;
+    if (profile_deltas) {
+        profiler = new cxxrtl::delta_profiler(all_debug_items);
+    }
+
+    Cosim* cosim = NULL;
+    if (cosim_name != NULL) {
+        std::string name = std::string("/") + cosim_name;
+        cosim            = cosim_create(&console, name.c_str(), mmio_base, mmio_size);
+        print(&console, INFO "Waiting for a driver to attach to \"%s\".\n", make_bytes(name.c_str()));
+        flush(&console);
+        cosim_wait_for_driver(cosim);
+        shm_unlink(name.c_str());
+    }
+
     value<1>& clock = cpu.p_clock;
-    for (I64 cycle = 0; cycle < 1000; cycle++) {
+    for (I64 cycle = 0; cycle < cycle_count; cycle++) {
+        if (recorder != NULL) {
+            recorder->advance_time(cxxrtl::time(0, 1000000000 /* 1 us */));
+        }
+
         cpu.p_reset.set(cycle == 0);
 
         U32 read_address = cpu.p_read__address.get<U32>() % memory.size;
-        U32 read_data    = *(U32*) &memory.data[read_address];
+        U32 read_data    = 0;
+        if (cosim != NULL && cosim_contains(cosim, read_address)) {
+            cosim_send(&cosim->requests, (CosimMessage) { COSIM_READ, read_address, 0, 0, cycle });
+            CosimMessage response = cosim_receive(&cosim->responses);
+            assert(response.kind == COSIM_READ_DATA);
+            read_data = response.data;
+        } else {
+            read_data = *(U32*) &memory.data[read_address];
+        }
         cpu.p_read__data = value<32>(read_data);
 
         U32 write_address = cpu.p_write__address.get<U32>() % memory.size;
         U32 write_data    = cpu.p_write__data.get<U32>();
         U32 write_enable  = cpu.p_write__enable.get<U32>();
-        for (I64 i = 0; i < 4; i++) {
-            if (test_bit(write_enable, i)) {
-                memory.data[write_address + i] = write_data >> (8 * i);
+        if (cosim != NULL && cosim_contains(cosim, write_address)) {
+            if (write_enable != 0) {
+                CosimMessage request = { COSIM_WRITE, write_address, write_data, write_enable, cycle };
+                cosim_send(&cosim->requests, request);
+            }
+        } else {
+            for (I64 i = 0; i < 4; i++) {
+                if (test_bit(write_enable, i)) {
+                    memory.data[write_address + i] = write_data >> (8 * i);
+                }
             }
         }
 
         clock.set(true);
-        cpu.step();
+        step(cpu, recorder, profiler);
 
         vcd.sample(2 * cycle);
 
         clock.set(false);
         cpu.p_reset.set(false);
-        cpu.step();
+        step(cpu, recorder, profiler);
 
         vcd.sample(2 * cycle + 1);
 
@@ -95,13 +367,25 @@ int main(int argc, char** argv) {
         vcd.buffer.clear();
     }
 
-    for (I64 i = 0; i < 32; i++) {
-        U8    storage[20] = {};
-        Bytes i_bytes     = i64_to_string(i, 10, storage);
-        i_bytes           = prepend(i_bytes, "x");
-        i_bytes           = left_pad(i_bytes, ' ', 4);
-        I64   value       = cpu.memory_p_registers[i].get<U32>();
-        print(&console, "%s = 0x%x\n", i_bytes, value);
+    if (cosim != NULL) {
+        cosim_send(&cosim->requests, (CosimMessage) { COSIM_EXIT, 0, 0, 0, cycle_count });
+    }
+
+    if (debug) {
+        // The recorder has to be flushed before the recording is read back.
+        delete recorder;
+        delete spool;
+
+        Debugger* debugger = new Debugger(spool_path);
+        run_debugger(&console, debugger);
+        delete debugger;
+    } else {
+        print_registers(&console, cpu);
+    }
+
+    if (profiler != NULL) {
+        print_delta_profile(&console, profiler);
+        delete profiler;
     }
 
     flush(&console);
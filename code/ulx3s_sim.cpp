@@ -0,0 +1,150 @@
+#include <cxxrtl/cxxrtl.h>
+#include <cxxrtl/capi/cxxrtl_capi.h>
+
+#include "base/prelude.h"
+#include "base/buffer.h"
+#include "ulx3s_sim.h"
+#include "../output/Cpu.hpp"
+
+// Room for the bytes of a word accessed at the end of the memory.
+static const I64 memory_padding = 4;
+
+// The design is only accessed through the C API of CXXRTL, so the library does
+// not depend on the names of the generated C++ members.
+struct Ulx3sSim {
+    cxxrtl_handle handle;
+
+    cxxrtl_object* clock;
+    cxxrtl_object* reset;
+    cxxrtl_object* read_data;
+    cxxrtl_object* read_address;
+    cxxrtl_object* write_address;
+    cxxrtl_object* write_data;
+    cxxrtl_object* write_enable;
+    cxxrtl_object* pc;
+    cxxrtl_object* registers;
+
+    U8* memory;
+    I64 memory_size;
+    I64 cycle;
+};
+
+static U32* input_chunks(cxxrtl_object* object) {
+    return object->next != NULL ? object->next : object->curr;
+}
+
+ULX3S_SIM_EXPORT Ulx3sSim* ulx3s_sim_create(uint64_t memory_size) {
+    if (memory_size < 4 || (memory_size & (memory_size - 1)) != 0 || memory_size > (1ull << 32)) {
+        return NULL;
+    }
+
+    U8* memory = try_os_allocate(memory_size + memory_padding);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+
+    Ulx3sSim* sim      = new Ulx3sSim {};
+    sim->handle        = cxxrtl_create(cxxrtl_design_create());
+    sim->clock         = cxxrtl_get(sim->handle, "clock");
+    sim->reset         = cxxrtl_get(sim->handle, "reset");
+    sim->read_data     = cxxrtl_get(sim->handle, "read_data");
+    sim->read_address  = cxxrtl_get(sim->handle, "read_address");
+    sim->write_address = cxxrtl_get(sim->handle, "write_address");
+    sim->write_data    = cxxrtl_get(sim->handle, "write_data");
+    sim->write_enable  = cxxrtl_get(sim->handle, "write_enable");
+    sim->pc            = cxxrtl_get(sim->handle, "pc");
+    sim->registers     = cxxrtl_get(sim->handle, "registers");
+    sim->memory        = memory;
+    sim->memory_size   = memory_size;
+
+    // A model generated from a different design or without the debug
+    // information of these signals would only fail on first use.
+    cxxrtl_object* objects[] = {
+        sim->clock, sim->reset, sim->read_data, sim->read_address, sim->write_address,
+        sim->write_data, sim->write_enable, sim->pc, sim->registers,
+    };
+    for (I64 i = 0; i < length(objects); i++) {
+        if (objects[i] == NULL) {
+            ulx3s_sim_destroy(sim);
+            return NULL;
+        }
+    }
+    if (sim->registers->depth != 32) {
+        ulx3s_sim_destroy(sim);
+        return NULL;
+    }
+    return sim;
+}
+
+ULX3S_SIM_EXPORT int ulx3s_sim_load_firmware(Ulx3sSim* sim, const uint8_t* data, size_t size) {
+    if ((I64) size > sim->memory_size) {
+        return -1;
+    }
+    // Resetting the design does not update its outputs, which would still hold
+    // the bus accesses of the previous firmware in the reset cycle.
+    cxxrtl_reset(sim->handle);
+    *input_chunks(sim->clock) = 0;
+    *input_chunks(sim->reset) = 1;
+    cxxrtl_step(sim->handle);
+
+    // Dropping the pages zeroes them without touching the ones that were
+    // never used, which matters for large memories.
+    madvise(sim->memory, sim->memory_size + memory_padding, MADV_DONTNEED);
+    memcpy(sim->memory, data, size);
+    sim->cycle = 0;
+    return 0;
+}
+
+ULX3S_SIM_EXPORT uint64_t ulx3s_sim_run(Ulx3sSim* sim, uint64_t cycle_count) {
+    U32* clock         = input_chunks(sim->clock);
+    U32* reset         = input_chunks(sim->reset);
+    U32* read_data     = input_chunks(sim->read_data);
+    U32* read_address  = sim->read_address->curr;
+    U32* write_address = sim->write_address->curr;
+    U32* write_data    = sim->write_data->curr;
+    U32* write_enable  = sim->write_enable->curr;
+    I64  address_mask  = sim->memory_size - 1;
+
+    for (I64 i = 0; i < (I64) cycle_count; i++) {
+        *reset = sim->cycle == 0;
+
+        *read_data = *(U32*) &sim->memory[*read_address & address_mask];
+
+        U8* bytes = &sim->memory[*write_address & address_mask];
+        for (I64 j = 0; j < 4; j++) {
+            if (test_bit(*write_enable, j)) {
+                bytes[j] = *write_data >> (8 * j);
+            }
+        }
+
+        *clock = 1;
+        cxxrtl_step(sim->handle);
+
+        *clock = 0;
+        *reset = 0;
+        cxxrtl_step(sim->handle);
+
+        sim->cycle++;
+    }
+    return sim->cycle;
+}
+
+ULX3S_SIM_EXPORT void ulx3s_sim_read_registers(Ulx3sSim* sim, uint32_t* registers) {
+    memcpy(registers, sim->registers->curr, 32 * sizeof(U32));
+}
+
+ULX3S_SIM_EXPORT uint32_t ulx3s_sim_read_pc(Ulx3sSim* sim) {
+    return sim->pc->curr[0];
+}
+
+ULX3S_SIM_EXPORT void ulx3s_sim_read_memory(Ulx3sSim* sim, uint32_t address, uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = sim->memory[(address + i) & (sim->memory_size - 1)];
+    }
+}
+
+ULX3S_SIM_EXPORT void ulx3s_sim_destroy(Ulx3sSim* sim) {
+    cxxrtl_destroy(sim->handle);
+    munmap(sim->memory, sim->memory_size + memory_padding);
+    delete sim;
+}
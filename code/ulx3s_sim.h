@@ -0,0 +1,61 @@
+// C API of libulx3s_sim.so, the CPU simulator as a shared library.
+//
+// A harness that runs many short simulations (for example a Python test
+// suite through ctypes) can keep one simulation per process and reuse it:
+//
+//   sim = ulx3s_sim_create(1 << 16)
+//   for every test:
+//       ulx3s_sim_load_firmware(sim, firmware, size)
+//       ulx3s_sim_run(sim, cycles)
+//       ulx3s_sim_read_registers(sim, registers)
+//   ulx3s_sim_destroy(sim)
+//
+// The memory of a simulation repeats over the whole address space, just like
+// in batch_simulator, so firmware that only uses its first `memory_size` bytes
+// behaves as in simulator. There is no co-simulation window. Functions of
+// different simulations may be called from different threads at the same time.
+
+#ifndef ULX3S_SIM_H
+#define ULX3S_SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ULX3S_SIM_EXPORT __attribute__((visibility("default")))
+
+typedef struct Ulx3sSim Ulx3sSim;
+
+// Creates a simulation with `memory_size` bytes of zeroed memory, which must
+// be a power of two of at least 4. Returns NULL if `memory_size` is invalid,
+// the memory cannot be allocated or the model lacks a signal the library uses.
+ULX3S_SIM_EXPORT Ulx3sSim* ulx3s_sim_create(uint64_t memory_size);
+
+// Resets the CPU, zeroes the memory and copies `size` bytes of machine code to
+// its start. The next cycle run is the reset cycle. Returns 0, or -1 if the
+// firmware does not fit into the memory.
+ULX3S_SIM_EXPORT int ulx3s_sim_load_firmware(Ulx3sSim* sim, const uint8_t* data, size_t size);
+
+// Runs `cycle_count` cycles and returns the number of cycles run since the
+// firmware was loaded.
+ULX3S_SIM_EXPORT uint64_t ulx3s_sim_run(Ulx3sSim* sim, uint64_t cycle_count);
+
+// Copies x0 to x31 into `registers`, which must have room for 32 words.
+ULX3S_SIM_EXPORT void ulx3s_sim_read_registers(Ulx3sSim* sim, uint32_t* registers);
+
+ULX3S_SIM_EXPORT uint32_t ulx3s_sim_read_pc(Ulx3sSim* sim);
+
+// Copies `size` bytes of memory from `address` on into `data`, wrapping around
+// at the end of the memory.
+ULX3S_SIM_EXPORT void ulx3s_sim_read_memory(Ulx3sSim* sim, uint32_t address, uint8_t* data, size_t size);
+
+ULX3S_SIM_EXPORT void ulx3s_sim_destroy(Ulx3sSim* sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,3 +1,6 @@
+// code/batched_cpu.h is a hand-written copy of this module for the batch
+// simulator, and must be updated with every change to it. Building with
+// ./build.py --batch-simulator checks the copy against this module.
 module Cpu
     ( input  logic       clock
     , input  logic       reset